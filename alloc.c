@@ -0,0 +1,119 @@
+// Counting allocator for everything main.c allocates, so --stats=json can report allocations
+// and live bytes per stage. Each block carries its size in a prefix, which lets frees be
+// counted; the totals are atomics since writer threads allocate too. Blocks from mem_alloc
+// and friends must be released with mem_free, never free().
+
+#include <stdatomic.h>
+
+#define MEM_PREFIX 16           // keeps the returned pointer 16-byte aligned
+
+typedef struct {
+    uint64_t allocs;            // mem_alloc, mem_calloc and mem_strdup calls
+    uint64_t reallocs;
+    uint64_t frees;
+    uint64_t bytes;             // bytes requested; a realloc adds only what it grew by
+    int64_t live;
+    int64_t peak;               // highest live since the last mem_reset_peak()
+} mem_stats_t;
+
+static atomic_uint_fast64_t mem_allocs, mem_reallocs, mem_frees, mem_bytes;
+static atomic_int_fast64_t  mem_live, mem_peak, mem_peak_total;
+
+
+static void mem_raise(atomic_int_fast64_t *peak, int64_t live) {
+    int_fast64_t seen = atomic_load_explicit(peak, memory_order_relaxed);
+    while (live > seen && !atomic_compare_exchange_weak_explicit(peak, &seen, live, memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+static void mem_account(int64_t delta) {
+    int64_t live = atomic_fetch_add_explicit(&mem_live, delta, memory_order_relaxed) + delta;
+
+    if (delta > 0) {
+        atomic_fetch_add_explicit(&mem_bytes, delta, memory_order_relaxed);
+        mem_raise(&mem_peak, live);
+        mem_raise(&mem_peak_total, live);
+    }
+}
+
+static void *mem_track(void *block, size_t size) {
+    if (!block)
+        return NULL;
+
+    *(size_t *)block = size;
+    mem_account((int64_t)size);
+    return (uint8_t *)block + MEM_PREFIX;
+}
+
+void *mem_alloc(size_t size) {
+    if (size > SIZE_MAX - MEM_PREFIX)
+        return NULL;
+
+    atomic_fetch_add_explicit(&mem_allocs, 1, memory_order_relaxed);
+    return mem_track(malloc(size + MEM_PREFIX), size);
+}
+
+void *mem_calloc(size_t count, size_t size) {
+    if (size && count > (SIZE_MAX - MEM_PREFIX) / size)
+        return NULL;
+
+    atomic_fetch_add_explicit(&mem_allocs, 1, memory_order_relaxed);
+    return mem_track(calloc(1, count * size + MEM_PREFIX), count * size);
+}
+
+void *mem_realloc(void *ptr, size_t size) {
+    if (!ptr)
+        return mem_alloc(size);
+    if (size > SIZE_MAX - MEM_PREFIX)
+        return NULL;
+
+    uint8_t *block = (uint8_t *)ptr - MEM_PREFIX;
+    size_t old     = *(size_t *)block;
+
+    block = realloc(block, size + MEM_PREFIX);
+    if (!block)
+        return NULL;
+
+    atomic_fetch_add_explicit(&mem_reallocs, 1, memory_order_relaxed);
+    *(size_t *)block = size;
+    mem_account((int64_t)size - (int64_t)old);
+    return block + MEM_PREFIX;
+}
+
+void mem_free(void *ptr) {
+    if (!ptr)
+        return;
+
+    uint8_t *block = (uint8_t *)ptr - MEM_PREFIX;
+
+    atomic_fetch_add_explicit(&mem_frees, 1, memory_order_relaxed);
+    mem_account(-(int64_t)*(size_t *)block);
+    free(block);
+}
+
+char *mem_strdup(const char *s) {
+    size_t size = strlen(s) + 1;
+    char *copy  = mem_alloc(size);
+
+    if (copy)
+        memcpy(copy, s, size);
+    return copy;
+}
+
+void mem_snapshot(mem_stats_t *stats) {
+    stats->allocs   = atomic_load_explicit(&mem_allocs, memory_order_relaxed);
+    stats->reallocs = atomic_load_explicit(&mem_reallocs, memory_order_relaxed);
+    stats->frees    = atomic_load_explicit(&mem_frees, memory_order_relaxed);
+    stats->bytes    = atomic_load_explicit(&mem_bytes, memory_order_relaxed);
+    stats->live     = atomic_load_explicit(&mem_live, memory_order_relaxed);
+    stats->peak     = atomic_load_explicit(&mem_peak, memory_order_relaxed);
+}
+
+// Starts a new peak window at the current live size.
+void mem_reset_peak(void) {
+    atomic_store_explicit(&mem_peak, atomic_load_explicit(&mem_live, memory_order_relaxed), memory_order_relaxed);
+}
+
+int64_t mem_peak_live(void) {
+    return atomic_load_explicit(&mem_peak_total, memory_order_relaxed);
+}
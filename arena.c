@@ -0,0 +1,85 @@
+// Bump allocator for things that live exactly as long as one job, like the slice names and
+// output paths of a plan. Allocation moves a pointer through a chunk; when a chunk is full the
+// next one is chained in front of it. Nothing is freed on its own: arena_free() releases every
+// chunk at once. An arena is used by one thread at a time. Needs alloc.c in the same unit.
+
+#include <stdarg.h>
+
+#define ARENA_CHUNK 16384           // a few hundred names; longer strings get a chunk of their own size
+#define ARENA_ALIGN 16
+
+typedef struct arena_chunk {
+    struct arena_chunk *next;
+} arena_chunk_t;
+
+// Zero-initialise before use; arena_free() leaves it empty and ready to be used again.
+typedef struct {
+    arena_chunk_t *chunks;          // newest first
+    uint8_t *pos;
+    uint8_t *end;
+} arena_t;
+
+
+void *arena_alloc(arena_t *a, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    if (!a->pos || (size_t)(a->end - a->pos) < size) {
+        size_t usable = size > ARENA_CHUNK ? size : ARENA_CHUNK;
+
+        if (usable > SIZE_MAX - ARENA_ALIGN)
+            return NULL;
+
+        // the header takes one alignment unit, so what follows it stays aligned
+        arena_chunk_t *chunk = mem_alloc(ARENA_ALIGN + usable);
+        if (!chunk)
+            return NULL;
+
+        chunk->next = a->chunks;
+        a->chunks   = chunk;
+        a->pos      = (uint8_t *)chunk + ARENA_ALIGN;
+        a->end      = a->pos + usable;
+    }
+
+    void *p  = a->pos;
+    a->pos  += size;
+    return p;
+}
+
+char *arena_strdup(arena_t *a, const char *s) {
+    size_t size = strlen(s) + 1;
+    char *copy  = arena_alloc(a, size);
+
+    if (copy)
+        memcpy(copy, s, size);
+    return copy;
+}
+
+// printf into a string of exactly the needed length. Returns NULL without memory.
+char *arena_printf(arena_t *a, const char *fmt, ...) {
+    va_list ap;
+
+    va_start(ap, fmt);
+    int n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+
+    if (n < 0)
+        return NULL;
+
+    char *s = arena_alloc(a, (size_t)n + 1);
+    if (s) {
+        va_start(ap, fmt);
+        vsnprintf(s, (size_t)n + 1, fmt, ap);
+        va_end(ap);
+    }
+    return s;
+}
+
+void arena_free(arena_t *a) {
+    while (a->chunks) {
+        arena_chunk_t *next = a->chunks->next;
+        mem_free(a->chunks);
+        a->chunks = next;
+    }
+
+    a->pos = a->end = NULL;
+}
@@ -1,26 +1,33 @@
-let     { exec }    = require('child_process');
-const { promisify } = require('util');
-const {readdir,writeFile}            = require('fs/promises')
-
-
-exec = promisify(exec);
-
-async function run(file){
-    let {stdout} = await exec(`ffprobe -v quiet -print_format json -show_format  "${file}"`)
-    stdout = JSON.parse(stdout)
-    return stdout.format
+let     { execFile } = require('child_process');
+const { promisify }  = require('util');
+const { writeFile }  = require('fs/promises')
+
+
+execFile = promisify(execFile);
+
+// conv --probe reads only the headers and prints one JSON object per file;
+// it exits 1 when some of them could not be probed, which still has every line
+async function probe(dir){
+    let stdout
+    try {
+        ({stdout} = await execFile('./conv', ['--probe', dir], { maxBuffer: 64 << 20 }))
+    } catch (err) {
+        if (err.code !== 1)
+            throw err
+        stdout = err.stdout
+    }
+    return stdout.trim().split('\n').filter(line => line).map(line => JSON.parse(line))
 }
 
 async function main(inp) {
-    let files = await readdir(inp)
-    files     = files.map(n=>`${inp}/${n}`)
-
-    let out = await Promise.all(files.map(async(file)=>{
-        const data = await run(file)
-        return `"${file}":${JSON.stringify(data)}`
-    }))
-
-    out = JSON.parse(`{${out.join(',\n')}}`)
+    const out = {}
+
+    for (const info of await probe(inp)) {
+        if (info.error)
+            console.warn(`${info.file}: ${info.error}`)
+        else
+            out[info.file] = info
+    }
 
     console.log(out)
 
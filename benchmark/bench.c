@@ -0,0 +1,445 @@
+// Native benchmark: runs each stage of the tool separately over a corpus and reports
+// per-stage timings as JSON.
+//
+//   gcc -O3 -march=native -DMINIMP3_FLOAT_OUTPUT -o bench_native benchmark/bench.c -lsndfile -lpthread -lm
+//   ./bench_native [-n reps] [-s segment_seconds] [-o out.json] <file|dir>...
+
+#define CONV_NO_MAIN
+#include "../main.c"
+
+#include <dirent.h>
+#include <errno.h>
+
+#define MAX_REPS   1000
+#define MAX_FILES  4096
+
+typedef enum {
+    STAGE_DETECT,
+    STAGE_READ,
+    STAGE_DECODE,
+    STAGE_PLAN,
+    STAGE_COPY,
+    STAGE_WRITE,
+    STAGE_COUNT
+} bench_stage_t;
+
+static const char *stage_names[STAGE_COUNT] = {
+    "detect", "read", "decode", "plan", "copy", "write"
+};
+
+typedef struct {
+    double times[MAX_REPS];     // seconds, one per repetition
+    uint64_t bytes;             // bytes the stage consumes (0: not meaningful)
+    uint64_t frames;            // MPEG frames for decode, PCM frames otherwise (0: not meaningful)
+} stage_result_t;
+
+typedef struct {
+    const char *filename;
+    audio_type type;
+    uint64_t file_bytes;
+    double duration;
+    int ok;
+    stage_result_t stages[STAGE_COUNT];
+} file_result_t;
+
+typedef struct {
+    int reps;
+    int segment;                // seconds, whole: FIXED_LENGTH mode takes an integer
+    const char *out_path;
+} bench_config_t;
+
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// nearest-rank percentile of a sorted array
+static double percentile(const double *sorted, int n, double p) {
+    int rank = (int)(p / 100.0 * n + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    if (rank > n)
+        rank = n;
+    return sorted[rank - 1];
+}
+
+// Touches every page of the input, which is what the read stage costs the decoders.
+static int bench_read(const char *filename, uint64_t *size) {
+    const uint8_t *buf = map_file(filename, size);
+    if (!buf)
+        return -1;
+
+    volatile uint8_t sink = 0;
+    for (uint64_t i = 0; i < *size; i += 4096)
+        sink ^= buf[i];
+
+    unmap_file(buf, *size);
+    return 0;
+}
+
+static audio_data bench_decode(const char *filename, audio_type type, uint64_t *frames) {
+    audio_data audio = {0};
+    mp3_session_t session;
+    int rc;
+
+    *frames = 0;
+
+    if (type == AUDIO_WAV) {
+        audio   = read_wav(filename, MP3D_CH_NATIVE);
+        *frames = audio.channels ? audio.num_samples / audio.channels : 0;
+        return audio;
+    }
+
+    if (mp3_session_open(&session, filename, MP3D_CH_NATIVE, 1) != 0)
+        return audio;
+
+    while ((rc = mp3_session_decode(&session, SIZE_MAX)) > 0)
+        *frames += rc;
+
+    if (rc < 0) {
+        mp3_session_close(&session);
+        return audio;
+    }
+
+    return mp3_session_finish(&session);
+}
+
+// get_lengths() and slice_paths() as main() runs them, names and paths in arena.
+static unsigned short bench_plan(const char *filename, audio_data *audio, int segment, float lengths[][2],
+                                 const char *paths[], arena_t *arena, const char *prefix) {
+    const char *names[MAX_SLICES];
+    char seg[32];
+    snprintf(seg, sizeof(seg), "%d", segment);
+
+    char *outputs = strdup(AUTO_MODE);
+    char *starts  = strdup(seg);
+    char *ends    = strdup(prefix);
+    unsigned short count = 0;
+
+    if (outputs && starts && ends)
+        count = get_lengths(outputs, starts, ends, lengths, names, arena, filename, audio);
+    if (slice_paths(arena, names, count, "wav", paths) != 0)
+        count = 0;
+
+    free(outputs);
+    free(starts);
+    free(ends);
+    return count;
+}
+
+// Slice extraction as done by write_wave_slice, pool buffers included, without the write.
+static uint64_t bench_copy(const audio_data *audio, float lengths[][2], unsigned short count) {
+    uint64_t copied = 0;
+
+    for (int i = 0; i < count; i++) {
+        uint64_t start_sample = (uint64_t)(lengths[i][0] * audio->sample_rate) * audio->channels;
+        uint64_t end_sample   = (uint64_t)(lengths[i][1] * audio->sample_rate) * audio->channels;
+
+        if (end_sample > audio->num_samples)
+            end_sample = audio->num_samples;
+        if (start_sample >= end_sample)
+            continue;
+
+        W_D_TYPE *slice = pool_alloc((end_sample - start_sample) * sizeof(W_D_TYPE));
+        if (!slice)
+            continue;
+
+        memcpy(slice, (W_D_TYPE *)audio->samples + start_sample, (end_sample - start_sample) * sizeof(W_D_TYPE));
+        copied += end_sample - start_sample;
+        pool_free(slice);
+    }
+
+    return copied;
+}
+
+// The writer alone: slices are written straight from the decoded buffer.
+static uint64_t bench_write(const audio_data *audio, float lengths[][2], const char *paths[], unsigned short count) {
+    uint64_t written = 0;
+
+    for (int i = 0; i < count; i++) {
+        uint64_t start_sample = (uint64_t)(lengths[i][0] * audio->sample_rate) * audio->channels;
+        uint64_t end_sample   = (uint64_t)(lengths[i][1] * audio->sample_rate) * audio->channels;
+
+        if (end_sample > audio->num_samples)
+            end_sample = audio->num_samples;
+        if (start_sample >= end_sample)
+            continue;
+
+        if (write_wave(paths[i], (W_D_TYPE *)audio->samples + start_sample,
+                       (end_sample - start_sample) / audio->channels, audio->channels, audio->sample_rate) == 0)
+            written += (end_sample - start_sample) * sizeof(W_D_TYPE) + sizeof(wav_header);
+
+        unlink(paths[i]);
+    }
+
+    return written;
+}
+
+static void bench_file(file_result_t *r, const bench_config_t *cfg, const char *tmpdir) {
+    static float lengths[MAX_SLICES][2];
+    static const char *out_paths[MAX_SLICES];
+    arena_t arena = { 0 };
+
+    char prefix[MAX_FN_LENGTH];
+    snprintf(prefix, sizeof(prefix), "%s/slice", tmpdir);
+
+    r->ok = 0;
+
+    for (int rep = 0; rep < cfg->reps; rep++) {
+        stage_result_t *st = r->stages;
+        double t;
+
+        t = now_sec();
+        r->type = detect_audio_type(r->filename);
+        st[STAGE_DETECT].times[rep] = now_sec() - t;
+        st[STAGE_DETECT].bytes      = MAX_HEADER_SIZE;
+
+        if (r->type != AUDIO_MPEG && r->type != AUDIO_WAV) {
+            fprintf(stderr, "%s: unsupported audio format, skipped\n", r->filename);
+            return;
+        }
+
+        t = now_sec();
+        if (bench_read(r->filename, &r->file_bytes) != 0)
+            return;
+        st[STAGE_READ].times[rep] = now_sec() - t;
+        st[STAGE_READ].bytes      = r->file_bytes;
+
+        uint64_t frames;
+        t = now_sec();
+        audio_data audio = bench_decode(r->filename, r->type, &frames);
+        st[STAGE_DECODE].times[rep] = now_sec() - t;
+
+        if (!audio.samples || !audio.channels || !audio.sample_rate) {
+            fprintf(stderr, "%s: decode failed, skipped\n", r->filename);
+            free_audio_data(&audio);
+            return;
+        }
+
+        uint64_t pcm_frames = audio.num_samples / audio.channels;
+        r->duration = (double)pcm_frames / audio.sample_rate;
+        st[STAGE_DECODE].bytes  = r->file_bytes;
+        st[STAGE_DECODE].frames = frames;
+
+        t = now_sec();
+        unsigned short count = bench_plan(r->filename, &audio, cfg->segment, lengths, out_paths, &arena, prefix);
+        st[STAGE_PLAN].times[rep] = now_sec() - t;
+
+        t = now_sec();
+        uint64_t copied = bench_copy(&audio, lengths, count);
+        st[STAGE_COPY].times[rep] = now_sec() - t;
+        st[STAGE_COPY].bytes      = copied * sizeof(W_D_TYPE);
+        st[STAGE_COPY].frames     = copied / audio.channels;
+
+        t = now_sec();
+        st[STAGE_WRITE].bytes     = bench_write(&audio, lengths, out_paths, count);
+        st[STAGE_WRITE].times[rep] = now_sec() - t;
+        st[STAGE_WRITE].frames    = copied / audio.channels;
+
+        free_audio_data(&audio);
+        arena_free(&arena);
+    }
+
+    r->ok = 1;
+}
+
+static void json_rate(FILE *out, const char *key, double amount, double seconds) {
+    if (amount > 0 && seconds > 0)
+        fprintf(out, ", \"%s\": %.3f", key, amount / seconds);
+    else
+        fprintf(out, ", \"%s\": null", key);
+}
+
+// Stage summary; rates use the median time. rtf is processing time over audio duration.
+// With raw set, the amounts and every repetition's time follow, for compare.js.
+static void json_stage(FILE *out, const stage_result_t *st, int reps, double duration, int raw) {
+    double sorted[MAX_REPS], sum = 0;
+
+    memcpy(sorted, st->times, reps * sizeof(double));
+    qsort(sorted, reps, sizeof(double), cmp_double);
+    for (int i = 0; i < reps; i++)
+        sum += sorted[i];
+
+    double p50 = percentile(sorted, reps, 50);
+
+    fprintf(out, "{\"min_ms\": %.4f, \"p50_ms\": %.4f, \"p90_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f, \"mean_ms\": %.4f",
+            sorted[0] * 1e3, p50 * 1e3, percentile(sorted, reps, 90) * 1e3,
+            percentile(sorted, reps, 99) * 1e3, sorted[reps - 1] * 1e3, sum / reps * 1e3);
+    json_rate(out, "mb_s", st->bytes / 1e6, p50);
+    json_rate(out, "frames_s", (double)st->frames, p50);
+
+    if (duration > 0)
+        fprintf(out, ", \"rtf\": %.6g", p50 / duration);
+    else
+        fprintf(out, ", \"rtf\": null");
+
+    if (raw) {
+        fprintf(out, ", \"bytes\": %llu, \"frames\": %llu, \"samples_ms\": [",
+                (unsigned long long)st->bytes, (unsigned long long)st->frames);
+        for (int i = 0; i < reps; i++)
+            fprintf(out, "%s%.4f", i ? ", " : "", st->times[i] * 1e3);
+        fputc(']', out);
+    }
+
+    fputc('}', out);
+}
+
+static void json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', out);
+        if ((unsigned char)*s < 0x20)
+            fprintf(out, "\\u%04x", *s);
+        else
+            fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+static void write_report(FILE *out, const bench_config_t *cfg, const file_result_t *results, int count) {
+    stage_result_t totals[STAGE_COUNT];
+    double total_duration = 0;
+    int    files_ok       = 0;
+
+    memset(totals, 0, sizeof(totals));
+
+    fprintf(out, "{\n  \"reps\": %d,\n  \"segment\": %d,\n  \"files\": [", cfg->reps, cfg->segment);
+
+    for (int i = 0; i < count; i++) {
+        const file_result_t *r = &results[i];
+        if (!r->ok)
+            continue;
+
+        fprintf(out, "%s\n    {\"file\": ", files_ok ? "," : "");
+        json_string(out, r->filename);
+        fprintf(out, ", \"type\": \"%s\", \"bytes\": %llu, \"duration\": %.6f, \"stages\": {",
+                get_mime_type(r->type), (unsigned long long)r->file_bytes, r->duration);
+
+        for (int s = 0; s < STAGE_COUNT; s++) {
+            fprintf(out, "%s\n      \"%s\": ", s ? "," : "", stage_names[s]);
+            json_stage(out, &r->stages[s], cfg->reps, r->duration, 0);
+
+            // corpus totals add up each repetition across files
+            for (int k = 0; k < cfg->reps; k++)
+                totals[s].times[k] += r->stages[s].times[k];
+            totals[s].bytes  += r->stages[s].bytes;
+            totals[s].frames += r->stages[s].frames;
+        }
+
+        fprintf(out, "\n    }}");
+        total_duration += r->duration;
+        files_ok++;
+    }
+
+    fprintf(out, "\n  ],\n  \"corpus\": {\"files\": %d, \"duration\": %.6f, \"stages\": {", files_ok, total_duration);
+
+    for (int s = 0; s < STAGE_COUNT && files_ok; s++) {
+        fprintf(out, "%s\n    \"%s\": ", s ? "," : "", stage_names[s]);
+        json_stage(out, &totals[s], cfg->reps, total_duration, 1);
+    }
+
+    // the whole run's peak, every file and repetition included
+    fprintf(out, "\n  }, \"peak_rss_kb\": %ld}\n}\n", peak_rss_kb());
+}
+
+static int add_path(const char *path, const char *files[], int count) {
+    struct stat st;
+
+    if (stat(path, &st) != 0) {
+        perror(path);
+        return count;
+    }
+
+    if (!S_ISDIR(st.st_mode)) {
+        if (count < MAX_FILES)
+            files[count++] = strdup(path);
+        return count;
+    }
+
+    struct dirent **entries;
+    int n = scandir(path, &entries, NULL, alphasort);
+    if (n < 0) {
+        perror(path);
+        return count;
+    }
+
+    for (int i = 0; i < n; i++) {
+        char full[MAX_FN_LENGTH];
+
+        if (entries[i]->d_name[0] != '.' && count < MAX_FILES) {
+            snprintf(full, sizeof(full), "%s/%s", path, entries[i]->d_name);
+            if (stat(full, &st) == 0 && S_ISREG(st.st_mode))
+                files[count++] = strdup(full);
+        }
+        free(entries[i]);
+    }
+
+    free(entries);
+    return count;
+}
+
+int main(int argc, char *argv[]) {
+    bench_config_t cfg = { .reps = 5, .segment = 1, .out_path = "bench_native.json" };
+    static const char *files[MAX_FILES];
+    int count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            cfg.reps = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+            cfg.segment = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            cfg.out_path = argv[++i];
+        else
+            count = add_path(argv[i], files, count);
+    }
+
+    if (!count || cfg.reps < 1 || cfg.reps > MAX_REPS || cfg.segment < 1) {
+        fprintf(stderr, "Usage: %s [-n reps (1-%d)] [-s segment_seconds (>= 1)] [-o out.json] <file|dir>...\n",
+                argv[0], MAX_REPS);
+        return 1;
+    }
+
+    char tmpdir[] = "/tmp/bench_native_XXXXXX";
+    if (!mkdtemp(tmpdir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    file_result_t *results = calloc(count, sizeof(file_result_t));
+    if (!results) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        results[i].filename = files[i];
+        bench_file(&results[i], &cfg, tmpdir);
+    }
+
+    rmdir(tmpdir);
+
+    FILE *out = fopen(cfg.out_path, "w");
+    if (!out) {
+        perror("Error opening report for writing");
+        return 1;
+    }
+
+    write_report(out, &cfg, results, count);
+    fclose(out);
+
+    printf("\nBenchmark report written to %s\n", cfg.out_path);
+
+    for (int i = 0; i < count; i++)
+        free((void *)files[i]);
+    free(results);
+    return 0;
+}
@@ -54,7 +54,7 @@ async function run(cmd) {
 
 async function benchmark(file) {
     let out = await Promise.all([
-        await run(`perf stat ffmpeg -i "${file}" -f segment -segment_time 1 -c copy out1/a_%03d.wav`),
+        await run(`perf stat ffmpeg -i "${file}" -f segment -segment_time 1 -c:a pcm_f32le out1/a_%03d.wav`),
         await run(`perf stat ./conv "${file}" AUTO "1" "./out2/"`)
     ])
 
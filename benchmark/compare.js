@@ -0,0 +1,177 @@
+// Regression gate: reruns the corpus of a stored bench_native report and compares the two.
+//
+//   node benchmark/compare.js <baseline.json> [--bench ./bench_native] [-n reps] [-t percent] [-o current.json]
+//
+// Decode frames/s, write MB/s and peak RSS are gated. A rate regresses when its median is
+// worse than the baseline's by more than the threshold and the bootstrap 95% interval of
+// the change lies entirely on the worse side. Peak RSS is one number per run and regresses
+// past the threshold alone. The exit code is 1 on a regression and 2 on usage errors.
+
+let     { execFile } = require('child_process');
+const { promisify }  = require('util');
+const { readFile }   = require('fs/promises');
+
+execFile = promisify(execFile);
+
+const RESAMPLES = 2000;
+
+const gated = [
+    { name: 'decode frames/s', stage: 'decode', amount: 'frames', scale: 1 },
+    { name: 'write MB/s',      stage: 'write',  amount: 'bytes',  scale: 1e-6 },
+];
+
+
+function median(values) {
+    const s = [...values].sort((a, b) => a - b);
+    const m = s.length >> 1;
+    return s.length % 2 ? s[m] : (s[m - 1] + s[m]) / 2;
+}
+
+// mulberry32, so the intervals are the same on every run over the same samples
+function prng(seed) {
+    return () => {
+        seed = (seed + 0x6D2B79F5) | 0;
+        let t = Math.imul(seed ^ (seed >>> 15), 1 | seed);
+        t = (t + Math.imul(t ^ (t >>> 7), 61 | t)) ^ t;
+        return ((t ^ (t >>> 14)) >>> 0) / 4294967296;
+    };
+}
+
+function resample(values, random) {
+    return values.map(() => values[Math.floor(random() * values.length)]);
+}
+
+// Relative change of the median, current over baseline, with a bootstrap 95% interval.
+function compareSamples(base, cur) {
+    const random  = prng(1);
+    const changes = [];
+
+    for (let i = 0; i < RESAMPLES; i++)
+        changes.push(median(resample(cur, random)) / median(resample(base, random)) - 1);
+
+    changes.sort((a, b) => a - b);
+
+    return {
+        change: median(cur) / median(base) - 1,
+        low:    changes[Math.floor(RESAMPLES * 0.025)],
+        high:   changes[Math.ceil(RESAMPLES * 0.975) - 1],
+    };
+}
+
+function rates(stage, amount, scale) {
+    if (!stage || !stage.samples_ms)
+        return null;
+    return stage.samples_ms.map(ms => stage[amount] * scale / (ms / 1e3));
+}
+
+function pct(x) {
+    return `${x >= 0 ? '+' : ''}${(x * 100).toFixed(1)}%`;
+}
+
+function fmt(x) {
+    return x >= 100 ? x.toFixed(0) : x.toPrecision(3);
+}
+
+function printTable(rows) {
+    const header = ['metric', 'baseline', 'current', 'change', '95% CI', 'status'];
+    const widths = header.map((h, i) => Math.max(h.length, ...rows.map(r => r[i].length)));
+    const line   = cells => cells.map((c, i) => c.padEnd(widths[i])).join('  ');
+
+    console.log(line(header));
+    console.log(line(widths.map(w => '-'.repeat(w))));
+    rows.forEach(r => console.log(line(r)));
+}
+
+function usage() {
+    console.error('Usage: node compare.js <baseline.json> [--bench ./bench_native] [-n reps] [-t percent] [-o current.json]');
+    process.exit(2);
+}
+
+async function main(argv) {
+    let baselinePath = null, bench = './bench_native', reps = null, threshold = 5, outPath = 'bench_current.json';
+
+    for (let i = 0; i < argv.length; i++) {
+        const arg = argv[i];
+        if (arg === '--bench' && i + 1 < argv.length)   bench = argv[++i];
+        else if (arg === '-n' && i + 1 < argv.length)   reps = parseInt(argv[++i]);
+        else if (arg === '-t' && i + 1 < argv.length)   threshold = parseFloat(argv[++i]);
+        else if (arg === '-o' && i + 1 < argv.length)   outPath = argv[++i];
+        else if (!arg.startsWith('-') && !baselinePath) baselinePath = arg;
+        else usage();
+    }
+
+    if (!baselinePath || !(threshold >= 0) || (reps !== null && !(reps >= 2)))
+        usage();
+
+    const baseline = JSON.parse(await readFile(baselinePath, 'utf8'));
+    const files    = baseline.files.map(f => f.file);
+
+    if (!files.length || !baseline.corpus.stages.decode || !baseline.corpus.stages.decode.samples_ms) {
+        console.error(`${baselinePath} has no per-repetition samples; rerun bench_native to make a new baseline`);
+        process.exit(2);
+    }
+
+    reps = reps || baseline.reps;
+    console.log(`Rerunning ${files.length} files, ${reps} repetitions...`);
+    await execFile(bench, ['-n', `${reps}`, '-s', `${baseline.segment}`, '-o', outPath, ...files], { maxBuffer: 64 << 20 });
+
+    const current = JSON.parse(await readFile(outPath, 'utf8'));
+
+    const baseBytes = new Map(baseline.files.map(f => [f.file, f.bytes]));
+    const changed   = current.files.filter(f => baseBytes.get(f.file) !== f.bytes);
+    if (changed.length || current.files.length !== baseline.files.length)
+        console.warn(`Warning: corpus differs from the baseline (${changed.length} files changed, ` +
+                     `${current.files.length} of ${baseline.files.length} decoded)`);
+
+    const limit = threshold / 100;
+    const rows  = [];
+    let failed  = 0;
+
+    for (const m of gated) {
+        const base = rates(baseline.corpus.stages[m.stage], m.amount, m.scale);
+        const cur  = rates(current.corpus.stages[m.stage], m.amount, m.scale);
+        if (!base || !cur)
+            continue;
+
+        const c = compareSamples(base, cur);
+        let status = 'ok';
+        if (c.change < -limit && c.high < 0)
+            status = 'REGRESSED';
+        else if (c.low > 0)
+            status = 'faster';
+
+        failed |= status === 'REGRESSED';
+        rows.push([m.name, fmt(median(base)), fmt(median(cur)), pct(c.change), `${pct(c.low)} .. ${pct(c.high)}`, status]);
+    }
+
+    // lower is better; every stage is shown, none of the times are gated
+    for (const [stage, b] of Object.entries(baseline.corpus.stages)) {
+        const cur = current.corpus.stages[stage];
+        if (!cur || !b.samples_ms)
+            continue;
+
+        const c = compareSamples(b.samples_ms, cur.samples_ms);
+        const status = c.low > 0 ? 'slower' : c.high < 0 ? 'faster' : '';
+        rows.push([`${stage} ms`, fmt(median(b.samples_ms)), fmt(median(cur.samples_ms)), pct(c.change),
+                   `${pct(c.low)} .. ${pct(c.high)}`, status]);
+    }
+
+    if (baseline.corpus.peak_rss_kb > 0 && current.corpus.peak_rss_kb > 0) {
+        const change = current.corpus.peak_rss_kb / baseline.corpus.peak_rss_kb - 1;
+        const status = change > limit ? 'REGRESSED' : 'ok';
+
+        failed |= status === 'REGRESSED';
+        rows.push(['peak RSS KiB', `${baseline.corpus.peak_rss_kb}`, `${current.corpus.peak_rss_kb}`, pct(change), '', status]);
+    }
+
+    console.log();
+    printTable(rows);
+    console.log(`\nThreshold ${threshold}%, current report in ${outPath}: ${failed ? 'REGRESSION' : 'no regression'}`);
+
+    process.exit(failed ? 1 : 0);
+}
+
+main(process.argv.slice(2)).catch(error => {
+    console.error('Comparison failed:', error.message);
+    process.exit(2);
+});
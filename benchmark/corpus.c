@@ -0,0 +1,681 @@
+// Deterministic offline corpus: synthetic WAV inputs and MP3 test vectors, so that the
+// benchmarks need no download and no ffprobe. The same arguments always give the same bytes.
+//
+//   gcc -O2 -o corpus benchmark/corpus.c -lm
+//   ./corpus wav <out.wav> [-d seconds] [-r rate] [-c channels] [-s tone|noise|chirp|mix]
+//                          [-g gap,every] [-f] [-seed n]
+//   ./corpus mp3 <out.mp3> [-d seconds] [-v 1|2|2.5] [-r rate] [-c 1|2|ms] [-b kbps|vbr|free:kbps]
+//                          [-x lame|vbri|none] [-R] [-t] [-seed n]
+//   ./corpus vectors <dir>             the MP3 vectors checked in under benchmark/vectors
+//   ./corpus all <dir> [-d seconds]    the vectors plus a set of WAV inputs
+//
+// The MP3 streams are not encoded audio: every granule holds a few count1 spectral lines
+// that move over time. They are valid MPEG-1/2/2.5 Layer III and exercise frame sync, side
+// info, Huffman decoding, the bit reservoir, stereo modes, VBR/free-format framing and
+// Xing/LAME/VBRI/ID3/APE tags, with output that only depends on the decoder.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "../log.c"
+#include "../trace.c"
+#include "../wav.c"
+
+#define WAV_BLOCK_FRAMES 4096
+#define MP3_LAME_DELAY   576        // encoder delay written to the LAME tag
+#define MP3_DECODER_DELAY 529
+#define MAX_MP3_FRAME    2881       // 320 kbps at 8 kHz would be larger, but is not allowed
+
+typedef struct {
+    uint32_t state;
+} rng_t;
+
+typedef enum {
+    SIGNAL_TONE,
+    SIGNAL_NOISE,
+    SIGNAL_CHIRP,
+    SIGNAL_MIX
+} signal_t;
+
+typedef struct {
+    double seconds;
+    int rate;
+    int channels;
+    signal_t signal;
+    double gap;                 // seconds of silence at the end of every `every` seconds
+    double every;
+    int is_float;               // 32-bit float samples, 16-bit PCM otherwise
+    uint32_t seed;
+} wav_spec_t;
+
+typedef enum {
+    MP3_TAG_NONE,
+    MP3_TAG_LAME,               // Xing (VBR) or Info (CBR) frame with a LAME extension
+    MP3_TAG_VBRI
+} mp3_tag_t;
+
+typedef struct {
+    double seconds;
+    int version;                // 1, 2 or 25 (MPEG-2.5)
+    int rate;
+    int channels;
+    int mid_side;               // joint stereo with M/S, for two channels
+    int kbps;                   // 0 for VBR, negative for free format at -kbps
+    mp3_tag_t tag;
+    int reservoir;              // let main data start in earlier frames
+    int id3;                    // leading ID3v2 tag whose body looks like frame syncs
+    int tail;                   // APEv2 and ID3v1 tags at the end
+    uint32_t seed;
+} mp3_spec_t;
+
+typedef struct {
+    uint8_t *buf;
+    size_t capacity;
+    size_t bitpos;
+    int failed;
+} bit_writer_t;
+
+static const int mp3_bitrates[2][15] = {
+    { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },   // MPEG-1
+    { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 }        // MPEG-2/2.5
+};
+
+static const int mp3_rates[3][3] = {
+    { 44100, 48000, 32000 }, { 22050, 24000, 16000 }, { 11025, 12000, 8000 }
+};
+
+static const struct {
+    const char *name;
+    mp3_spec_t spec;
+} mp3_vectors[] = {
+    { "mpeg1_44100_stereo_128_cbr_lame.mp3", { 2.0, 1,  44100, 2, 0, 128, MP3_TAG_LAME, 1, 0, 0, 1 } },
+    { "mpeg1_48000_ms_vbr_xing.mp3",         { 2.0, 1,  48000, 2, 1,   0, MP3_TAG_LAME, 1, 0, 0, 2 } },
+    { "mpeg1_32000_mono_64_cbr.mp3",         { 2.0, 1,  32000, 1, 0,  64, MP3_TAG_NONE, 0, 0, 0, 3 } },
+    { "mpeg1_44100_stereo_vbr_vbri.mp3",     { 2.0, 1,  44100, 2, 0,   0, MP3_TAG_VBRI, 1, 0, 0, 4 } },
+    { "mpeg1_44100_stereo_free_200.mp3",     { 2.0, 1,  44100, 2, 0,-200, MP3_TAG_NONE, 1, 0, 0, 5 } },
+    { "mpeg1_44100_stereo_128_tagged.mp3",   { 2.0, 1,  44100, 2, 0, 128, MP3_TAG_LAME, 1, 1, 1, 6 } },
+    { "mpeg2_22050_stereo_64_cbr_lame.mp3",  { 2.0, 2,  22050, 2, 0,  64, MP3_TAG_LAME, 1, 0, 0, 7 } },
+    { "mpeg2_24000_ms_vbr_xing.mp3",         { 2.0, 2,  24000, 2, 1,   0, MP3_TAG_LAME, 1, 0, 0, 8 } },
+    { "mpeg2_16000_mono_32_cbr.mp3",         { 2.0, 2,  16000, 1, 0,  32, MP3_TAG_NONE, 0, 0, 0, 9 } },
+    { "mpeg25_11025_stereo_32_cbr_lame.mp3", { 2.0, 25, 11025, 2, 0,  32, MP3_TAG_LAME, 1, 0, 0, 10 } },
+    { "mpeg25_8000_mono_16_cbr.mp3",         { 2.0, 25,  8000, 1, 0,  16, MP3_TAG_NONE, 1, 0, 0, 11 } },
+};
+
+static const struct {
+    const char *name;
+    wav_spec_t spec;
+} wav_inputs[] = {
+    { "tone_44100_2ch.wav",        { 0, 44100, 2, SIGNAL_TONE,  0, 0, 0, 1 } },
+    { "noise_48000_2ch.wav",       { 0, 48000, 2, SIGNAL_NOISE, 0, 0, 0, 2 } },
+    { "chirp_22050_1ch.wav",       { 0, 22050, 1, SIGNAL_CHIRP, 0, 0, 0, 3 } },
+    { "mix_16000_1ch_gaps.wav",    { 0, 16000, 1, SIGNAL_MIX, 0.5, 5, 0, 4 } },
+    { "mix_8000_1ch.wav",          { 0,  8000, 1, SIGNAL_MIX,   0, 0, 0, 5 } },
+    { "tone_96000_2ch_float.wav",  { 0, 96000, 2, SIGNAL_TONE,  0, 0, 1, 6 } },
+};
+
+
+// xorshift32: the same sequence on every platform, unlike rand()
+static uint32_t rng_next(rng_t *rng) {
+    uint32_t x = rng->state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return rng->state = x;
+}
+
+static float rng_uniform(rng_t *rng) {
+    return (float)(rng_next(rng) >> 8) / (1 << 24) * 2.0f - 1.0f;
+}
+
+static float signal_sample(const wav_spec_t *spec, rng_t *rng, uint64_t frame, int ch) {
+    double t = (double)frame / spec->rate;
+
+    if (spec->every > 0 && fmod(t, spec->every) >= spec->every - spec->gap)
+        return 0;
+
+    double tone = 0, chirp = 0;
+    float noise = 0;
+
+    if (spec->signal == SIGNAL_TONE || spec->signal == SIGNAL_MIX) {
+        double f = ch & 1 ? 554.37 : 440.0;
+        tone = 0.5 * sin(2 * M_PI * f * t) + 0.15 * sin(4 * M_PI * f * t) + 0.1 * sin(6 * M_PI * f * t);
+    }
+
+    if (spec->signal == SIGNAL_CHIRP || spec->signal == SIGNAL_MIX) {
+        // logarithmic sweep from 20 Hz to just below Nyquist over the whole file
+        double f0 = 20, f1 = fmin(20000, 0.45 * spec->rate), k = log(f1 / f0);
+        chirp = 0.5 * sin(2 * M_PI * f0 * spec->seconds / k * (exp(k * t / spec->seconds) - 1));
+    }
+
+    if (spec->signal == SIGNAL_NOISE || spec->signal == SIGNAL_MIX)
+        noise = 0.25f * rng_uniform(rng);
+
+    if (spec->signal == SIGNAL_MIX)
+        return (float)(0.4 * tone + 0.3 * chirp + 0.6 * noise);
+
+    return (float)(tone + chirp + noise);
+}
+
+// Streams the samples out in blocks, so long inputs do not need to fit in memory.
+int make_wav(const char *filename, const wav_spec_t *spec) {
+    uint64_t frames = (uint64_t)llround(spec->seconds * spec->rate);
+    size_t sample_bytes = spec->is_float ? sizeof(float) : sizeof(int16_t);
+    uint64_t data_length = frames * spec->channels * sample_bytes;
+
+    if (spec->channels < 1 || spec->rate < 1 || data_length > UINT32_MAX - sizeof(wav_header)) {
+        fprintf(stderr, "%s: unsupported WAV size, rate or channel count\n", filename);
+        return -1;
+    }
+
+    wav_header header;
+    init_wav_header(&header, spec->is_float ? WAV_FORMAT_FLOAT : WAV_FORMAT_PCM, spec->channels,
+                    spec->rate, spec->is_float ? 32 : 16, (uint32_t)data_length);
+
+    FILE *fout = fopen(filename, "wb");
+    if (!fout) {
+        perror("Error opening file for writing");
+        return -1;
+    }
+
+    float   *block = malloc(WAV_BLOCK_FRAMES * spec->channels * sizeof(float));
+    int16_t *pcm   = malloc(WAV_BLOCK_FRAMES * spec->channels * sizeof(int16_t));
+    rng_t rng = { spec->seed ? spec->seed : 1 };
+    int rc = -1;
+
+    if (!block || !pcm) {
+        fprintf(stderr, "Memory allocation failed\n");
+        goto done;
+    }
+
+    if (fwrite(&header, sizeof(header), 1, fout) != 1) {
+        perror("Error writing WAV header");
+        goto done;
+    }
+
+    for (uint64_t f = 0; f < frames; f += WAV_BLOCK_FRAMES) {
+        size_t n = (size_t)(frames - f < WAV_BLOCK_FRAMES ? frames - f : WAV_BLOCK_FRAMES);
+
+        for (size_t i = 0; i < n; i++) {
+            for (int ch = 0; ch < spec->channels; ch++)
+                block[i * spec->channels + ch] = signal_sample(spec, &rng, f + i, ch);
+        }
+
+        const void *out = block;
+        if (!spec->is_float) {
+            for (size_t i = 0; i < n * spec->channels; i++)
+                pcm[i] = (int16_t)lrintf(fmaxf(-1.0f, fminf(block[i], 32767.0f / 32768)) * 32768);
+            out = pcm;
+        }
+
+        if (fwrite(out, sample_bytes * spec->channels, n, fout) != n) {
+            perror("Error writing WAV data");
+            goto done;
+        }
+    }
+
+    rc = 0;
+
+done:
+    free(block);
+    free(pcm);
+    if (fclose(fout) != 0 && rc == 0) {
+        perror("Error writing WAV data");
+        rc = -1;
+    }
+    return rc;
+}
+
+
+static void bw_put(bit_writer_t *w, uint32_t value, int bits) {
+    for (int i = bits - 1; i >= 0; i--) {
+        size_t byte = w->bitpos >> 3;
+
+        if (byte >= w->capacity) {
+            size_t capacity = w->capacity ? w->capacity * 2 : 4096;
+            uint8_t *grown  = realloc(w->buf, capacity);
+
+            if (!grown) {
+                w->failed = 1;
+                return;
+            }
+            memset(grown + w->capacity, 0, capacity - w->capacity);
+            w->buf      = grown;
+            w->capacity = capacity;
+        }
+
+        if ((value >> i) & 1)
+            w->buf[byte] |= 0x80 >> (w->bitpos & 7);
+        w->bitpos++;
+    }
+}
+
+static void put_be32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+// One granule of one channel: 24 count1 quadruples (table B, 4 bits each plus signs) with
+// two or three unit lines whose position drifts with time.
+static void write_granule(bit_writer_t *w, double t, int ch, uint32_t signs) {
+    int l1 = 4 + (int)(t * 9 + ch * 11) % 60;
+    int l2 = 20 + (ch * 17 + (int)(t * 3)) % 70;
+
+    for (int q = 0; q < 24; q++) {
+        int v[4];
+
+        for (int k = 0; k < 4; k++) {
+            int line = q * 4 + k;
+            v[k] = line == l1 || line == l1 + 1 || line == l2;
+        }
+
+        bw_put(w, 15 - (v[0] * 8 + v[1] * 4 + v[2] * 2 + v[3]), 4);
+        for (int k = 0; k < 4; k++) {
+            if (v[k])
+                bw_put(w, (signs >> ((q * 4 + k) & 31)) & 1, 1);
+        }
+    }
+}
+
+// Xing/Info header with frame count, byte count and TOC, followed by a LAME extension that
+// carries the encoder delay and padding.
+static void write_lame_tag(uint8_t *x, int vbr, uint32_t frames, const int *frame_bytes, int count, uint32_t delay, uint32_t padding) {
+    uint64_t total = 0;
+    for (int f = 0; f < count; f++)
+        total += frame_bytes[f];
+
+    memcpy(x, vbr ? "Xing" : "Info", 4);
+    put_be32(x + 4, 0x0F);                  // frames, bytes, TOC and quality present
+    put_be32(x + 8, frames);
+    put_be32(x + 12, (uint32_t)total);
+
+    uint64_t acc = 0;
+    for (int i = 0, f = 0; i < 100; i++) {
+        for (int target = i * count / 100; f < target; f++)
+            acc += frame_bytes[f];
+        x[16 + i] = (uint8_t)(acc * 256 / total);
+    }
+
+    uint8_t *lame = x + 120;
+    memcpy(lame, "LAME3.100", 9);
+    lame[21] = delay >> 4;
+    lame[22] = ((delay & 15) << 4) | (padding >> 8);
+    lame[23] = padding & 255;
+}
+
+static void write_vbri_tag(uint8_t *x, uint32_t frames, const int *frame_bytes, int count) {
+    uint64_t total = 0;
+    for (int f = 0; f < count; f++)
+        total += frame_bytes[f];
+
+    memcpy(x, "VBRI", 4);
+    x[5] = 1;                               // version
+    x[6] = MP3_LAME_DELAY >> 8;
+    x[7] = MP3_LAME_DELAY & 255;
+    put_be32(x + 10, (uint32_t)total);
+    put_be32(x + 14, frames);
+    x[21] = 1;                              // TOC scale; no TOC entries follow
+    x[23] = 2;
+}
+
+int make_mp3(const char *filename, const mp3_spec_t *spec) {
+    int mpeg1  = spec->version == 1;
+    int row    = spec->version == 1 ? 0 : spec->version == 2 ? 1 : 2;
+    int nch    = spec->channels == 1 ? 1 : 2;
+    int ms     = nch == 2 && spec->mid_side;
+    int spf    = mpeg1 ? 1152 : 576;
+    int ngr    = mpeg1 ? 2 : 1;
+    int side   = mpeg1 ? (nch == 1 ? 17 : 32) : (nch == 1 ? 9 : 17);
+    int coef   = mpeg1 ? 144 : 72;
+    int is_vbr = spec->kbps == 0;
+    int is_free = spec->kbps < 0;
+    const int *bitrates = mp3_bitrates[!mpeg1];
+
+    int sr_idx = -1;
+    for (int i = 0; i < 3; i++) {
+        if (mp3_rates[row][i] == spec->rate)
+            sr_idx = i;
+    }
+
+    int cbr_idx = 0;
+    for (int i = 1; i < 15; i++) {
+        if (bitrates[i] == spec->kbps)
+            cbr_idx = i;
+    }
+
+    if (sr_idx < 0 || (!is_vbr && !is_free && !cbr_idx) || (spec->tag == MP3_TAG_VBRI && !mpeg1)) {
+        fprintf(stderr, "%s: no such MPEG-%s stream (%d Hz, %d kbps, tag %d)\n", filename,
+                spec->version == 25 ? "2.5" : spec->version == 2 ? "2" : "1", spec->rate, spec->kbps, spec->tag);
+        return -1;
+    }
+
+    // with a LAME tag the playable length is exact: the padding covers the decoder delay too
+    uint64_t samples = (uint64_t)llround(spec->seconds * spec->rate);
+    int has_tag      = spec->tag != MP3_TAG_NONE;
+    int audio_frames = (int)((samples + (has_tag ? MP3_LAME_DELAY + MP3_DECODER_DELAY : 0) + spf - 1) / spf);
+    int count        = audio_frames + has_tag;
+    uint32_t padding = has_tag ? (uint32_t)((uint64_t)audio_frames * spf - samples - MP3_LAME_DELAY) : 0;
+
+    uint8_t **frames   = calloc(count, sizeof(uint8_t *));
+    int *frame_bytes   = calloc(count, sizeof(int));
+    bit_writer_t md    = {0};           // main data of all frames, back to back
+    rng_t rng          = { spec->seed ? spec->seed : 1 };
+    int64_t capacity_before = 0, md_end = 0;
+    int pad_acc = 0, rc = -1;
+
+    if (!frames || !frame_bytes) {
+        fprintf(stderr, "Memory allocation failed\n");
+        goto done;
+    }
+
+    for (int f = 0; f < count; f++) {
+        int is_tag = has_tag && f == 0;
+        int idx, bytes, pad = 0;
+
+        if (is_free) {
+            idx   = 0;
+            bytes = coef * -spec->kbps * 1000 / spec->rate;
+        } else {
+            idx = is_vbr ? (is_tag ? 9 : 5 + (int)(rng_next(&rng) % 9)) : cbr_idx;
+
+            int num = coef * bitrates[idx] * 1000;
+            bytes   = num / spec->rate;
+            if (spec->rate % 1000) {
+                pad_acc += num % spec->rate;
+                if (pad_acc >= spec->rate) {
+                    pad_acc -= spec->rate;
+                    pad = 1;
+                }
+            }
+        }
+
+        int size  = bytes + pad;
+        int need  = is_tag ? 4 + side + (spec->tag == MP3_TAG_VBRI ? 26 : 156) : 4 + side;
+        if (size < need || size > MAX_MP3_FRAME) {
+            fprintf(stderr, "%s: %d byte frames are too small for this stream\n", filename, size);
+            goto done;
+        }
+
+        frames[f]      = calloc(size, 1);
+        frame_bytes[f] = size;
+        if (!frames[f]) {
+            fprintf(stderr, "Memory allocation failed\n");
+            goto done;
+        }
+
+        bit_writer_t h = { frames[f], (size_t)size, 0, 0 };
+        bw_put(&h, 0x7FF, 11);
+        bw_put(&h, spec->version == 1 ? 3 : spec->version == 2 ? 2 : 0, 2);
+        bw_put(&h, 1, 2);                   // layer III
+        bw_put(&h, 1, 1);                   // no CRC
+        bw_put(&h, idx, 4);
+        bw_put(&h, sr_idx, 2);
+        bw_put(&h, pad, 1);
+        bw_put(&h, 0, 1);
+        bw_put(&h, nch == 1 ? 3 : ms ? 1 : 0, 2);
+        bw_put(&h, ms ? 2 : 0, 2);
+        bw_put(&h, 0, 1);
+        bw_put(&h, 1, 1);
+        bw_put(&h, 0, 2);
+
+        if (is_tag)
+            continue;
+
+        int payload = size - 4 - side;
+        bit_writer_t gr[2][2] = {{{0}}};
+        int total_bits = 0;
+        double t0 = (double)(f - has_tag) * spf / spec->rate;
+
+        for (int g = 0; g < ngr; g++) {
+            for (int ch = 0; ch < nch; ch++) {
+                write_granule(&gr[g][ch], t0 + g * 576.0 / spec->rate, ch, rng_next(&rng));
+                total_bits += (int)gr[g][ch].bitpos;
+            }
+        }
+
+        // main data goes as early as the reservoir allows, up to 255 bytes back
+        int64_t begin = spec->reservoir ? md_end : capacity_before;
+        if (begin < capacity_before - 255)
+            begin = capacity_before - 255;
+
+        if (begin + (total_bits + 7) / 8 > capacity_before + payload) {
+            fprintf(stderr, "%s: frame %d cannot hold its main data\n", filename, f);
+            for (int g = 0; g < ngr; g++)
+                for (int ch = 0; ch < nch; ch++)
+                    free(gr[g][ch].buf);
+            goto done;
+        }
+
+        while ((int64_t)(md.bitpos / 8) < begin)
+            bw_put(&md, 0, 8);
+
+        for (int g = 0; g < ngr; g++) {
+            for (int ch = 0; ch < nch; ch++) {
+                for (size_t i = 0; i < gr[g][ch].bitpos; i++)
+                    bw_put(&md, (gr[g][ch].buf[i >> 3] >> (7 - (i & 7))) & 1, 1);
+                free(gr[g][ch].buf);
+            }
+        }
+        while (md.bitpos & 7)
+            bw_put(&md, 0, 1);
+        md_end = md.bitpos / 8;
+
+        // side info
+        bw_put(&h, (uint32_t)(capacity_before - begin), mpeg1 ? 9 : 8);
+        bw_put(&h, 0, mpeg1 ? (nch == 1 ? 5 : 3) : (nch == 1 ? 1 : 2));
+        if (mpeg1)
+            bw_put(&h, 0, 4 * nch);         // scfsi
+
+        for (int g = 0; g < ngr; g++) {
+            for (int ch = 0; ch < nch; ch++) {
+                bw_put(&h, (uint32_t)gr[g][ch].bitpos, 12);     // part2_3_length
+                bw_put(&h, 0, 9);                               // big_values
+                bw_put(&h, 185 + (ms ? 2 : 0), 8);              // global_gain
+                bw_put(&h, 0, mpeg1 ? 4 : 9);                   // scalefac_compress
+                bw_put(&h, 0, 1);                               // long blocks
+                bw_put(&h, 0, 15);                              // table_select
+                bw_put(&h, 0, 4);                               // region0_count
+                bw_put(&h, 0, 3);                               // region1_count
+                if (mpeg1)
+                    bw_put(&h, 0, 1);                           // preflag
+                bw_put(&h, 0, 1);                               // scalefac_scale
+                bw_put(&h, 1, 1);                               // count1 table B
+            }
+        }
+
+        capacity_before += payload;
+    }
+
+    if (md.failed) {
+        fprintf(stderr, "Memory allocation failed\n");
+        goto done;
+    }
+
+    // scatter the main data over the payloads
+    int64_t pos = 0, md_bytes = md.bitpos / 8;
+    for (int f = has_tag; f < count; f++) {
+        for (int i = 4 + side; i < frame_bytes[f]; i++, pos++)
+            frames[f][i] = pos < md_bytes ? md.buf[pos] : 0;
+    }
+
+    if (spec->tag == MP3_TAG_LAME)
+        write_lame_tag(frames[0] + 4 + side, is_vbr, audio_frames, frame_bytes, count, MP3_LAME_DELAY, padding);
+    else if (spec->tag == MP3_TAG_VBRI)
+        write_vbri_tag(frames[0] + 4 + 32, audio_frames, frame_bytes, count);
+
+    FILE *fout = fopen(filename, "wb");
+    if (!fout) {
+        perror("Error opening file for writing");
+        goto done;
+    }
+
+    int ok = 1;
+
+    if (spec->id3) {
+        // a 64 KiB ID3v2.4 tag full of bytes that look like frame headers
+        uint32_t tag = 65536;
+        uint8_t head[10] = { 'I', 'D', '3', 4, 0, 0, (tag >> 21) & 127, (tag >> 14) & 127, (tag >> 7) & 127, tag & 127 };
+        ok &= fwrite(head, 1, sizeof(head), fout) == sizeof(head);
+        for (uint32_t i = 0; i < tag && ok; i++)
+            ok &= fputc(i % 7 == 0 ? 0xFF : 0xE0 | (i & 0x1F), fout) != EOF;
+    }
+
+    for (int f = 0; f < count && ok; f++)
+        ok &= fwrite(frames[f], 1, frame_bytes[f], fout) == (size_t)frame_bytes[f];
+
+    if (spec->tail && ok) {
+        // APEv2 with header and footer around 40 bytes of items, then ID3v1
+        uint8_t footer[32] = { 'A', 'P', 'E', 'T', 'A', 'G', 'E', 'X', 0xD0, 0x07, 0, 0, 32 + 40, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0x80 };
+        uint8_t header[32], items[40], id3v1[128];
+
+        memcpy(header, footer, sizeof(header));
+        header[23] = 0xA0;
+        memset(items, 0xFF, sizeof(items));
+        memset(id3v1, 0xFF, sizeof(id3v1));
+        memcpy(id3v1, "TAG", 3);
+
+        ok &= fwrite(header, 1, sizeof(header), fout) == sizeof(header);
+        ok &= fwrite(items, 1, sizeof(items), fout) == sizeof(items);
+        ok &= fwrite(footer, 1, sizeof(footer), fout) == sizeof(footer);
+        ok &= fwrite(id3v1, 1, sizeof(id3v1), fout) == sizeof(id3v1);
+    }
+
+    ok &= fclose(fout) == 0;
+    if (!ok) {
+        perror("Error writing MP3 data");
+        goto done;
+    }
+
+    rc = 0;
+
+done:
+    for (int f = 0; frames && f < count; f++)
+        free(frames[f]);
+    free(frames);
+    free(frame_bytes);
+    free(md.buf);
+    return rc;
+}
+
+
+static int write_vectors(const char *dir) {
+    char path[4096];
+
+    for (size_t i = 0; i < sizeof(mp3_vectors) / sizeof(mp3_vectors[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, mp3_vectors[i].name);
+        if (make_mp3(path, &mp3_vectors[i].spec) != 0)
+            return -1;
+        printf("%s\n", path);
+    }
+    return 0;
+}
+
+static int write_all(const char *dir, double seconds) {
+    char path[4096];
+
+    if (write_vectors(dir) != 0)
+        return -1;
+
+    for (size_t i = 0; i < sizeof(wav_inputs) / sizeof(wav_inputs[0]); i++) {
+        wav_spec_t spec = wav_inputs[i].spec;
+        spec.seconds = seconds;
+
+        snprintf(path, sizeof(path), "%s/%s", dir, wav_inputs[i].name);
+        if (make_wav(path, &spec) != 0)
+            return -1;
+        printf("%s\n", path);
+    }
+    return 0;
+}
+
+static int usage(const char *prog) {
+    fprintf(stderr, "Usage: %s wav <out.wav> [-d seconds] [-r rate] [-c channels] [-s tone|noise|chirp|mix] [-g gap,every] [-f] [-seed n]\n", prog);
+    fprintf(stderr, "       %s mp3 <out.mp3> [-d seconds] [-v 1|2|2.5] [-r rate] [-c 1|2|ms] [-b kbps|vbr|free:kbps] [-x lame|vbri|none] [-R] [-t] [-seed n]\n", prog);
+    fprintf(stderr, "       %s vectors <dir>\n", prog);
+    fprintf(stderr, "       %s all <dir> [-d seconds]\n", prog);
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3)
+        return usage(argv[0]);
+
+    const char *cmd = argv[1], *out = argv[2];
+    wav_spec_t wav = { 10, 44100, 2, SIGNAL_MIX, 0, 0, 0, 1 };
+    mp3_spec_t mp3 = { 10, 1, 44100, 2, 0, 128, MP3_TAG_LAME, 1, 0, 0, 1 };
+    double seconds = 60;
+
+    for (int i = 3; i < argc; i++) {
+        const char *arg = argv[i];
+
+        if (strcmp(arg, "-f") == 0) {
+            wav.is_float = 1;
+            continue;
+        } else if (strcmp(arg, "-R") == 0) {
+            mp3.reservoir = 0;
+            continue;
+        } else if (strcmp(arg, "-t") == 0) {
+            mp3.id3 = mp3.tail = 1;
+            continue;
+        } else if (i + 1 == argc) {
+            return usage(argv[0]);
+        }
+
+        const char *val = argv[++i];
+
+        if (strcmp(arg, "-d") == 0) {
+            seconds = wav.seconds = mp3.seconds = atof(val);
+        } else if (strcmp(arg, "-r") == 0) {
+            wav.rate = mp3.rate = atoi(val);
+        } else if (strcmp(arg, "-c") == 0) {
+            wav.channels = mp3.channels = strcmp(val, "ms") == 0 ? 2 : atoi(val);
+            mp3.mid_side = strcmp(val, "ms") == 0;
+        } else if (strcmp(arg, "-s") == 0) {
+            if (strcmp(val, "tone") == 0)
+                wav.signal = SIGNAL_TONE;
+            else if (strcmp(val, "noise") == 0)
+                wav.signal = SIGNAL_NOISE;
+            else if (strcmp(val, "chirp") == 0)
+                wav.signal = SIGNAL_CHIRP;
+            else if (strcmp(val, "mix") == 0)
+                wav.signal = SIGNAL_MIX;
+            else
+                return usage(argv[0]);
+        } else if (strcmp(arg, "-g") == 0) {
+            if (sscanf(val, "%lf,%lf", &wav.gap, &wav.every) != 2 || wav.gap < 0 || wav.gap > wav.every)
+                return usage(argv[0]);
+        } else if (strcmp(arg, "-seed") == 0) {
+            wav.seed = mp3.seed = (uint32_t)strtoul(val, NULL, 10);
+        } else if (strcmp(arg, "-v") == 0) {
+            mp3.version = strcmp(val, "2.5") == 0 ? 25 : atoi(val);
+        } else if (strcmp(arg, "-b") == 0) {
+            mp3.kbps = strcmp(val, "vbr") == 0 ? 0 : strncmp(val, "free:", 5) == 0 ? -atoi(val + 5) : atoi(val);
+        } else if (strcmp(arg, "-x") == 0) {
+            mp3.tag = strcmp(val, "vbri") == 0 ? MP3_TAG_VBRI : strcmp(val, "none") == 0 ? MP3_TAG_NONE : MP3_TAG_LAME;
+        } else {
+            return usage(argv[0]);
+        }
+    }
+
+    if (strcmp(cmd, "wav") == 0)
+        return make_wav(out, &wav) != 0;
+    if (strcmp(cmd, "mp3") == 0)
+        return make_mp3(out, &mp3) != 0;
+
+    if (strcmp(cmd, "vectors") != 0 && strcmp(cmd, "all") != 0)
+        return usage(argv[0]);
+
+    if (mkdir(out, 0755) != 0 && errno != EEXIST) {
+        perror("Error creating output directory");
+        return 1;
+    }
+
+    return (strcmp(cmd, "all") == 0 ? write_all(out, seconds) : write_vectors(out)) != 0;
+}
@@ -0,0 +1,327 @@
+// The minimp3 kernels built for one SIMD path. Compiled once per path (see kernels.c):
+//   -DKERNEL_PATH=scalar -DMINIMP3_NO_SIMD
+//   -DKERNEL_PATH=sse
+//   -DKERNEL_PATH=avx2 -mavx2 -mfma
+// minimp3 has SSE2/NEON intrinsics only, so the avx2 build is that code VEX-encoded, with the
+// compiler free to fuse multiply-adds.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernels.h"
+
+#define KERNEL_CAT_(a, b) a##_##b
+#define KERNEL_CAT(a, b)  KERNEL_CAT_(a, b)
+#define KERNEL_SYM(name)  KERNEL_CAT(name, KERNEL_PATH)
+
+// every path links into one binary: keep minimp3's public symbols apart
+#define mp3dec_init            KERNEL_SYM(mp3dec_init)
+#define mp3dec_decode_frame    KERNEL_SYM(mp3dec_decode_frame)
+#define mp3dec_decode_frame_ch KERNEL_SYM(mp3dec_decode_frame_ch)
+#define mp3dec_f32_to_s16      KERNEL_SYM(mp3dec_f32_to_s16)
+
+#define MINIMP3_ONLY_MP3
+#define MINIMP3_FLOAT_OUTPUT
+#define MINIMP3_IMPLEMENTATION
+
+static kernel_capture_t *g_capture;     // the capture being recorded, only set inside capture()
+
+static void capture_L3_huffman(const void *bs, const void *gr_info, const float *scf, int layer3gr_limit);
+static void capture_L3_antialias(const float *grbuf, int nbands);
+static void capture_L3_imdct_gr(const float *grbuf, const float *overlap, unsigned block_type, unsigned n_long_bands);
+static void capture_mp3d_synth_granule(const float *qmf_state, const float *grbuf, int nbands, int nch);
+
+#define MINIMP3_CAPTURE(kernel, ...) do { if (g_capture) capture_##kernel(__VA_ARGS__); } while (0)
+
+#include "../minimp3.h"
+
+#define HUFFMAN_SLACK 8     /* bytes the bit reader may look ahead */
+
+typedef struct {
+    uint8_t data[MAX_BITRESERVOIR_BYTES + MAX_L3_FRAME_PAYLOAD_BYTES + HUFFMAN_SLACK];
+    int pos, limit, gr_limit;
+    L3_gr_info_t gr_info;
+    float scf[40];
+} huffman_input_t;
+
+typedef struct {
+    float grbuf[576];
+    int nbands;
+} antialias_input_t;
+
+typedef struct {
+    float grbuf[576], overlap[9*32];
+    unsigned block_type, n_long_bands;
+} imdct_input_t;
+
+typedef struct {
+    float grbuf[2*576];         // before DCT-II
+    float dct[2*576];           // after DCT-II: the synthesis input
+    float qmf_state[15*64];
+    float pcm[2*576];           // synthesis output: the f32 -> s16 input
+    int nbands, nch;
+} synth_input_t;
+
+struct kernel_capture {
+    huffman_input_t *huffman;
+    antialias_input_t *antialias;
+    imdct_input_t *imdct[2];    // long blocks, short (or mixed) blocks
+    synth_input_t *synth;
+    size_t n_huffman, n_antialias, n_imdct[2], n_synth, max;
+};
+
+
+static void capture_L3_huffman(const void *bs_ptr, const void *gr_info, const float *scf, int layer3gr_limit) {
+    const bs_t *bs = bs_ptr;
+    kernel_capture_t *cap = g_capture;
+
+    if (cap->n_huffman == cap->max)
+        return;
+
+    huffman_input_t *in = &cap->huffman[cap->n_huffman++];
+    int first = bs->pos / 8;
+    int last  = MINIMP3_MIN(bs->limit / 8, layer3gr_limit / 8 + HUFFMAN_SLACK);
+
+    memset(in->data, 0, sizeof(in->data));
+    memcpy(in->data, bs->buf + first, MINIMP3_MAX(last - first, 0));
+    in->pos      = bs->pos - first*8;
+    in->limit    = bs->limit - first*8;
+    in->gr_limit = layer3gr_limit - first*8;
+    in->gr_info  = *(const L3_gr_info_t *)gr_info;
+    memcpy(in->scf, scf, sizeof(in->scf));
+}
+
+static void capture_L3_antialias(const float *grbuf, int nbands) {
+    kernel_capture_t *cap = g_capture;
+
+    if (cap->n_antialias == cap->max)
+        return;
+
+    antialias_input_t *in = &cap->antialias[cap->n_antialias++];
+    memcpy(in->grbuf, grbuf, sizeof(in->grbuf));
+    in->nbands = nbands;
+}
+
+static void capture_L3_imdct_gr(const float *grbuf, const float *overlap, unsigned block_type, unsigned n_long_bands) {
+    kernel_capture_t *cap = g_capture;
+    int is_short = block_type == SHORT_BLOCK_TYPE;
+
+    if (cap->n_imdct[is_short] == cap->max)
+        return;
+
+    imdct_input_t *in = &cap->imdct[is_short][cap->n_imdct[is_short]++];
+    memcpy(in->grbuf, grbuf, sizeof(in->grbuf));
+    memcpy(in->overlap, overlap, sizeof(in->overlap));
+    in->block_type   = block_type;
+    in->n_long_bands = n_long_bands;
+}
+
+// The synthesis and conversion inputs are derived here with this path's own kernels, which
+// is why capture() is called on the scalar path.
+static void capture_mp3d_synth_granule(const float *qmf_state, const float *grbuf, int nbands, int nch) {
+    kernel_capture_t *cap = g_capture;
+    float lins[(18 + 15)*64];
+
+    if (cap->n_synth == cap->max)
+        return;
+
+    synth_input_t *in = &cap->synth[cap->n_synth++];
+    memset(in, 0, sizeof(*in));
+    memcpy(in->grbuf, grbuf, sizeof(float)*576*nch);
+    memcpy(in->dct, grbuf, sizeof(float)*576*nch);
+    memcpy(in->qmf_state, qmf_state, sizeof(in->qmf_state));
+    in->nbands = nbands;
+    in->nch    = nch;
+
+    for (int i = 0; i < nch; i++)
+        mp3d_DCT_II(in->dct + 576*i, nbands);
+
+    float work[2*576];
+    memcpy(work, in->dct, sizeof(float)*576*nch);
+    memcpy(lins, qmf_state, sizeof(float)*15*64);
+    for (int i = 0; i < nbands; i += 2)
+        mp3d_synth(work + i, in->pcm + 32*nch*i, nch, lins + i*64);
+}
+
+static void free_capture(kernel_capture_t *cap) {
+    if (!cap)
+        return;
+    free(cap->huffman);
+    free(cap->antialias);
+    free(cap->imdct[0]);
+    free(cap->imdct[1]);
+    free(cap->synth);
+    free(cap);
+}
+
+static kernel_capture_t *capture(const uint8_t *mp3, size_t size, size_t max_granules) {
+    kernel_capture_t *cap = calloc(1, sizeof(kernel_capture_t));
+    if (!cap)
+        return NULL;
+
+    cap->max       = max_granules;
+    cap->huffman   = malloc(max_granules * sizeof(huffman_input_t));
+    cap->antialias = malloc(max_granules * sizeof(antialias_input_t));
+    cap->imdct[0]  = malloc(max_granules * sizeof(imdct_input_t));
+    cap->imdct[1]  = malloc(max_granules * sizeof(imdct_input_t));
+    cap->synth     = malloc(max_granules * sizeof(synth_input_t));
+
+    if (!cap->huffman || !cap->antialias || !cap->imdct[0] || !cap->imdct[1] || !cap->synth) {
+        free_capture(cap);
+        return NULL;
+    }
+
+    mp3dec_t dec;
+    mp3dec_frame_info_t info;
+    float pcm[MINIMP3_MAX_SAMPLES_PER_FRAME];
+
+    mp3dec_init(&dec);
+    g_capture = cap;
+
+    while (size > 0 && cap->n_synth < max_granules) {
+        mp3dec_decode_frame(&dec, mp3, (int)MINIMP3_MIN(size, (size_t)INT32_MAX), pcm, &info);
+        if (!info.frame_bytes)
+            break;
+        mp3  += info.frame_bytes;
+        size -= info.frame_bytes;
+    }
+
+    g_capture = NULL;
+    return cap;
+}
+
+static kernel_output_t output(kernel_id_t k, const kernel_capture_t *cap) {
+    kernel_output_t out = {0};
+
+    switch (k) {
+        case KERNEL_L3_HUFFMAN:
+            out.items = cap->n_huffman;
+            out.bytes = out.items * 576 * sizeof(float);
+            break;
+        case KERNEL_L3_ANTIALIAS:
+            out.items = cap->n_antialias;
+            out.bytes = out.items * 576 * sizeof(float);
+            break;
+        case KERNEL_L3_IMDCT36:
+        case KERNEL_L3_IMDCT_SHORT:
+            out.items = cap->n_imdct[k == KERNEL_L3_IMDCT_SHORT];
+            out.bytes = out.items * sizeof(imdct_input_t);
+            break;
+        case KERNEL_DCT_II:
+            out.items = cap->n_synth;
+            out.bytes = out.items * 2 * 576 * sizeof(float);
+            break;
+        case KERNEL_SYNTH:
+            out.items = cap->n_synth;
+            out.bytes = out.items * 2 * 576 * sizeof(float);
+            break;
+        case KERNEL_F32_TO_S16:
+            out.items  = cap->n_synth;
+            out.bytes  = out.items * 2 * 576 * sizeof(int16_t);
+            out.is_s16 = 1;
+            break;
+        default:
+            break;
+    }
+
+    // per-channel kernels process 576 samples per item; synthesis and conversion, 576 per channel
+    out.samples = out.items * 576;
+    if (k == KERNEL_DCT_II || k == KERNEL_SYNTH || k == KERNEL_F32_TO_S16) {
+        out.samples = 0;
+        for (size_t i = 0; i < cap->n_synth; i++)
+            out.samples += 576 * cap->synth[i].nch;
+    }
+
+    return out;
+}
+
+static void load(kernel_id_t k, const kernel_capture_t *cap, void *out) {
+    float *f = out;
+
+    switch (k) {
+        case KERNEL_L3_HUFFMAN:
+            memset(f, 0, cap->n_huffman * 576 * sizeof(float));
+            break;
+        case KERNEL_L3_ANTIALIAS:
+            for (size_t i = 0; i < cap->n_antialias; i++)
+                memcpy(f + 576*i, cap->antialias[i].grbuf, 576 * sizeof(float));
+            break;
+        case KERNEL_L3_IMDCT36:
+        case KERNEL_L3_IMDCT_SHORT: {
+            int is_short = k == KERNEL_L3_IMDCT_SHORT;
+            memcpy(out, cap->imdct[is_short], cap->n_imdct[is_short] * sizeof(imdct_input_t));
+            break;
+        }
+        case KERNEL_DCT_II:
+            for (size_t i = 0; i < cap->n_synth; i++)
+                memcpy(f + 2*576*i, cap->synth[i].grbuf, 2 * 576 * sizeof(float));
+            break;
+        default:
+            // mono granules leave half of their output slot untouched
+            memset(out, 0, output(k, cap).bytes);
+            break;
+    }
+}
+
+static void run(kernel_id_t k, const kernel_capture_t *cap, void *out) {
+    float *f = out;
+
+    switch (k) {
+        case KERNEL_L3_HUFFMAN:
+            for (size_t i = 0; i < cap->n_huffman; i++) {
+                const huffman_input_t *in = &cap->huffman[i];
+                bs_t bs = { in->data, in->pos, in->limit };
+                L3_huffman(f + 576*i, &bs, &in->gr_info, in->scf, in->gr_limit);
+            }
+            break;
+        case KERNEL_L3_ANTIALIAS:
+            for (size_t i = 0; i < cap->n_antialias; i++)
+                L3_antialias(f + 576*i, cap->antialias[i].nbands);
+            break;
+        case KERNEL_L3_IMDCT36:
+        case KERNEL_L3_IMDCT_SHORT: {
+            imdct_input_t *in = out;
+            size_t n = cap->n_imdct[k == KERNEL_L3_IMDCT_SHORT];
+            for (size_t i = 0; i < n; i++)
+                L3_imdct_gr(in[i].grbuf, in[i].overlap, in[i].block_type, in[i].n_long_bands);
+            break;
+        }
+        case KERNEL_DCT_II:
+            for (size_t i = 0; i < cap->n_synth; i++)
+                for (int ch = 0; ch < cap->synth[i].nch; ch++)
+                    mp3d_DCT_II(f + 2*576*i + 576*ch, cap->synth[i].nbands);
+            break;
+        case KERNEL_SYNTH: {
+            float lins[(18 + 15)*64];
+            for (size_t i = 0; i < cap->n_synth; i++) {
+                // mp3d_synth reads its input in place only; the captured DCT output is reused
+                const synth_input_t *in = &cap->synth[i];
+                memcpy(lins, in->qmf_state, sizeof(float)*15*64);
+                for (int b = 0; b < in->nbands; b += 2)
+                    mp3d_synth((float *)in->dct + b, f + 2*576*i + 32*in->nch*b, in->nch, lins + b*64);
+            }
+            break;
+        }
+        case KERNEL_F32_TO_S16:
+            for (size_t i = 0; i < cap->n_synth; i++)
+                mp3dec_f32_to_s16(cap->synth[i].pcm, (int16_t *)out + 2*576*i, 576 * cap->synth[i].nch);
+            break;
+        default:
+            break;
+    }
+}
+
+#if defined(MINIMP3_NO_SIMD)
+#define KERNEL_PATH_NAME "scalar"
+#elif defined(__AVX2__)
+#define KERNEL_PATH_NAME "avx2"
+#elif HAVE_SSE
+#define KERNEL_PATH_NAME "sse"
+#else
+#define KERNEL_PATH_NAME "neon"
+#endif
+
+const kernel_path_t KERNEL_SYM(kernel_path) = {
+    KERNEL_PATH_NAME, capture, free_capture, output, load, run
+};
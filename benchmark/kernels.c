@@ -0,0 +1,238 @@
+// Microbenchmarks of the minimp3 hot kernels, per SIMD path, on inputs captured from a real
+// MP3. Every path's output is checked against the scalar build.
+//
+//   gcc -O3 -c -DKERNEL_PATH=scalar -DMINIMP3_NO_SIMD benchmark/kernel_path.c -o kp_scalar.o
+//   gcc -O3 -c -DKERNEL_PATH=sse                     benchmark/kernel_path.c -o kp_sse.o
+//   gcc -O3 -c -DKERNEL_PATH=avx2 -mavx2 -mfma       benchmark/kernel_path.c -o kp_avx2.o
+//   gcc -O3 -o bench_kernels benchmark/kernels.c kp_scalar.o kp_sse.o kp_avx2.o -lm
+//   ./bench_kernels [-n reps] [-g granules] [-o out.json] <file.mp3>
+//
+// Leave out kp_avx2.o (or kp_sse.o) where that path cannot be built. Exits non-zero when
+// a path disagrees with the scalar reference.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#else
+#define HAVE_TSC 0
+#endif
+
+#define MAX_REPS 1000
+
+extern const kernel_path_t kernel_path_sse  __attribute__((weak));
+extern const kernel_path_t kernel_path_avx2 __attribute__((weak));
+
+static const char *kernel_names[KERNEL_COUNT] = {
+    "L3_huffman", "L3_antialias", "L3_imdct36", "L3_imdct_short",
+    "mp3d_DCT_II", "mp3d_synth", "mp3dec_f32_to_s16"
+};
+
+typedef struct {
+    double ns;
+    double tsc;
+} kernel_time_t;
+
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint64_t read_tsc(void) {
+#if HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static int cmp_time(const void *a, const void *b) {
+    double x = ((const kernel_time_t *)a)->ns, y = ((const kernel_time_t *)b)->ns;
+    return (x > y) - (x < y);
+}
+
+static int path_available(const kernel_path_t *path) {
+    if (!path)
+        return 0;
+#if defined(__x86_64__) || defined(__i386__)
+    if (path == &kernel_path_avx2)
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+    return 1;
+}
+
+// Median of reps runs; inputs are reloaded before each run, outside the timed region.
+static kernel_time_t time_kernel(const kernel_path_t *path, kernel_id_t k, const kernel_capture_t *cap, void *out, int reps) {
+    static kernel_time_t times[MAX_REPS];
+
+    for (int r = 0; r < reps; r++) {
+        path->load(k, cap, out);
+
+        double   t0 = now_ns();
+        uint64_t c0 = read_tsc();
+        path->run(k, cap, out);
+        uint64_t c1 = read_tsc();
+        double   t1 = now_ns();
+
+        times[r].ns  = t1 - t0;
+        times[r].tsc = (double)(c1 - c0);
+    }
+
+    qsort(times, reps, sizeof(kernel_time_t), cmp_time);
+    return times[reps / 2];
+}
+
+// Largest difference from the reference, relative to the reference's peak for float output.
+static double compare_output(const kernel_output_t *o, const void *ref, const void *out) {
+    double err = 0, peak = 0;
+
+    if (o->is_s16) {
+        const int16_t *a = ref, *b = out;
+        for (size_t i = 0; i < o->bytes / sizeof(int16_t); i++)
+            err = fmax(err, abs(a[i] - b[i]));
+        return err;
+    }
+
+    const float *a = ref, *b = out;
+    for (size_t i = 0; i < o->bytes / sizeof(float); i++) {
+        err  = fmax(err, fabs((double)a[i] - b[i]));
+        peak = fmax(peak, fabs((double)a[i]));
+    }
+
+    return peak > 0 ? err / peak : err;
+}
+
+static uint8_t *read_input(const char *filename, size_t *size) {
+    FILE *fin = fopen(filename, "rb");
+    if (!fin) {
+        perror("Error opening input file");
+        return NULL;
+    }
+
+    fseek(fin, 0, SEEK_END);
+    *size = (size_t)ftell(fin);
+    fseek(fin, 0, SEEK_SET);
+
+    uint8_t *buf = malloc(*size ? *size : 1);
+    if (!buf || fread(buf, 1, *size, fin) != *size) {
+        fprintf(stderr, "Failed to read input file: %s\n", filename);
+        free(buf);
+        buf = NULL;
+    }
+
+    fclose(fin);
+    return buf;
+}
+
+int main(int argc, char *argv[]) {
+    int reps = 20;
+    size_t granules = 2000;
+    const char *input = NULL, *out_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            reps = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc)
+            granules = (size_t)atol(argv[++i]);
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            out_path = argv[++i];
+        else
+            input = argv[i];
+    }
+
+    if (!input || reps < 1 || reps > MAX_REPS || granules < 1) {
+        fprintf(stderr, "Usage: %s [-n reps (1-%d)] [-g granules] [-o out.json] <file.mp3>\n", argv[0], MAX_REPS);
+        return 1;
+    }
+
+    size_t size;
+    uint8_t *mp3 = read_input(input, &size);
+    if (!mp3)
+        return 1;
+
+    const kernel_path_t *ref_path = &kernel_path_scalar;
+    const kernel_path_t *paths[] = { &kernel_path_scalar, &kernel_path_sse, &kernel_path_avx2 };
+    const int n_paths = sizeof(paths) / sizeof(paths[0]);
+
+    kernel_capture_t *cap = ref_path->capture(mp3, size, granules);
+    if (!cap) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(mp3);
+        return 1;
+    }
+
+    FILE *out = out_path ? fopen(out_path, "w") : stdout;
+    if (!out) {
+        perror("Error opening report for writing");
+        return 1;
+    }
+
+    int failed = 0;
+
+    fprintf(out, "{\n  \"input\": \"%s\",\n  \"reps\": %d,\n  \"kernels\": {", input, reps);
+
+    for (int k = 0; k < KERNEL_COUNT; k++) {
+        kernel_output_t o = ref_path->output(k, cap);
+        void *ref = malloc(o.bytes ? o.bytes : 1);
+        void *buf = malloc(o.bytes ? o.bytes : 1);
+
+        if (!ref || !buf) {
+            fprintf(stderr, "Memory allocation failed\n");
+            return 1;
+        }
+
+        ref_path->load(k, cap, ref);
+        ref_path->run(k, cap, ref);
+
+        fprintf(out, "%s\n    \"%s\": {\"granules\": %zu, \"samples\": %zu, \"paths\": {",
+                k ? "," : "", kernel_names[k], o.items, o.samples);
+
+        int first = 1;
+        for (int p = 0; p < n_paths; p++) {
+            if (!path_available(paths[p]) || !o.items)
+                continue;
+
+            kernel_time_t t = time_kernel(paths[p], k, cap, buf, reps);
+            double err      = compare_output(&o, ref, buf);
+
+            // huffman decoding is exact; s16 may round one step differently; float within 1e-5 of peak
+            double tolerance = k == KERNEL_L3_HUFFMAN ? 0 : o.is_s16 ? 1 : 1e-5;
+            int ok = err <= tolerance;
+            failed |= !ok;
+
+            fprintf(out, "%s\n      \"%s\": {\"ns_per_granule\": %.2f, ", first ? "" : ",",
+                    paths[p]->name, t.ns / o.items);
+            if (HAVE_TSC)
+                fprintf(out, "\"cycles_per_sample\": %.4f, ", t.tsc / o.samples);
+            else
+                fprintf(out, "\"cycles_per_sample\": null, ");
+            fprintf(out, "\"max_err\": %.3g, \"ok\": %s}", err, ok ? "true" : "false");
+            first = 0;
+
+            if (!ok)
+                fprintf(stderr, "%s: %s path differs from scalar (max error %g)\n", kernel_names[k], paths[p]->name, err);
+        }
+
+        fprintf(out, "\n    }}");
+        free(ref);
+        free(buf);
+    }
+
+    fprintf(out, "\n  }\n}\n");
+
+    if (out != stdout)
+        fclose(out);
+
+    ref_path->free_capture(cap);
+    free(mp3);
+    return failed;
+}
@@ -0,0 +1,43 @@
+// Interface between benchmark/kernels.c and the per-SIMD-path builds of benchmark/kernel_path.c.
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    KERNEL_L3_HUFFMAN,
+    KERNEL_L3_ANTIALIAS,
+    KERNEL_L3_IMDCT36,
+    KERNEL_L3_IMDCT_SHORT,
+    KERNEL_DCT_II,
+    KERNEL_SYNTH,
+    KERNEL_F32_TO_S16,
+    KERNEL_COUNT
+} kernel_id_t;
+
+// Inputs recorded from real frames; opaque outside kernel_path.c, but every path build
+// shares its layout, so one capture feeds all paths.
+typedef struct kernel_capture kernel_capture_t;
+
+typedef struct {
+    size_t bytes;               // output buffer size
+    size_t items;               // granules (per channel, but per granule for synth)
+    size_t samples;             // output samples, all channels
+    int is_s16;                 // output is int16_t, float otherwise
+} kernel_output_t;
+
+typedef struct {
+    const char *name;
+
+    kernel_capture_t *(*capture)(const uint8_t *mp3, size_t size, size_t max_granules);
+    void (*free_capture)(kernel_capture_t *cap);
+
+    kernel_output_t (*output)(kernel_id_t k, const kernel_capture_t *cap);
+    // fills out with the kernel's input, for the kernels that work in place (not timed)
+    void (*load)(kernel_id_t k, const kernel_capture_t *cap, void *out);
+    // runs the kernel over every captured input (timed)
+    void (*run)(kernel_id_t k, const kernel_capture_t *cap, void *out);
+} kernel_path_t;
+
+extern const kernel_path_t kernel_path_scalar;
+extern const kernel_path_t kernel_path_sse;
+extern const kernel_path_t kernel_path_avx2;
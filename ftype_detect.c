@@ -3,7 +3,7 @@
 // #include <string.h>
 // #include <time.h>
 
-#define MAX_HEADER_SIZE 16
+#define MAX_HEADER_SIZE 36
 
 typedef enum {
     AUDIO_UNKNOWN = 0,
@@ -28,35 +28,29 @@ static const char* mime_types_map[AUDIO_TYPE_COUNT] = {
     "audio/opus"
 };
 
-audio_type detect_audio_type(const char *filename) {
-    
-
+// Classifies the first bytes of a file; size may be less than MAX_HEADER_SIZE.
+audio_type detect_audio_buffer(const uint8_t *data, size_t size) {
+    uint8_t buffer[MAX_HEADER_SIZE] = {0};
 
-    FILE *file = fopen(filename, "rb");
-    if (!file) {
-        perror("Error opening file");
+    if (size < 12) {
         return AUDIO_UNKNOWN;
     }
 
-    uint8_t buffer[MAX_HEADER_SIZE];
-    size_t read_bytes = fread(buffer, 1, MAX_HEADER_SIZE, file);
-    fclose(file);
-
-    if (read_bytes < 12) {
-        return AUDIO_UNKNOWN;
-    }
+    memcpy(buffer, data, size < MAX_HEADER_SIZE ? size : MAX_HEADER_SIZE);
 
     uint64_t header64;
     uint32_t header32;
     memcpy(&header64, buffer, sizeof(header64));
     memcpy(&header32, buffer, sizeof(header32));
 
-    int is_wav   = (header32 == 0x46464952) & (*(uint32_t*)(buffer + 8) == 0x45564157); // WAV: "RIFF" + "WAVE"
-    int is_mp3   = ((header32 & 0xFFFFFF) == 0x334449) | (((buffer[0] & 0xFF) == 0xFF) & ((buffer[1] & 0xE0) == 0xE0)); // MP3: "ID3" or MPEG frame
+    int is_wav   = ((header32 == 0x46464952) | (header32 == 0x34364652)) & (*(uint32_t*)(buffer + 8) == 0x45564157); // WAV: "RIFF" or "RF64" + "WAVE"
+    // MPEG audio and ADTS share the 12-bit sync; ADTS has layer bits 00, which MPEG audio reserves
+    int is_sync  = (buffer[0] == 0xFF) & ((buffer[1] & 0xE0) == 0xE0);
+    int is_mp3   = ((header32 & 0xFFFFFF) == 0x334449) | (is_sync & ((buffer[1] & 0x06) != 0)); // MP3: "ID3" or MPEG frame
     int is_flac  = (header32 == 0x43614C66); // FLAC: "fLaC"
-    int is_ogg   = (header32 == 0x5367674F); // OGG: "OggS"
-    int is_opus  = is_ogg & (buffer[28] == 1); // OPUS: Ogg with Opus codec flag
-    int is_aac   = ((buffer[0] == 0xFF) & ((buffer[1] & 0xF0) == 0xF0)); // AAC: ADTS Sync word
+    int is_opus  = (header32 == 0x5367674F) & (memcmp(buffer + 28, "OpusHead", 8) == 0); // OPUS: Ogg with an Opus ID header
+    int is_ogg   = (header32 == 0x5367674F) & !is_opus; // OGG: "OggS"
+    int is_aac   = is_sync & ((buffer[1] & 0xF6) == 0xF0); // AAC: ADTS sync word, layer 00
     int is_amr   = (*(uint32_t*)buffer == 0x524D4123); // AMR: "#!AMR"
 
 
@@ -69,11 +63,23 @@ audio_type detect_audio_type(const char *filename) {
            is_amr * AUDIO_AMR |
            AUDIO_UNKNOWN;
 
-    printf("%s auto detected to be %s\n",filename,mime_types_map[type]);
-
     return type;
 }
 
+audio_type detect_audio_type(const char *filename) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        perror("Error opening file");
+        return AUDIO_UNKNOWN;
+    }
+
+    uint8_t buffer[MAX_HEADER_SIZE];
+    size_t read_bytes = fread(buffer, 1, MAX_HEADER_SIZE, file);
+    fclose(file);
+
+    return detect_audio_buffer(buffer, read_bytes);
+}
+
 static inline const char* get_mime_type(audio_type type) {
     return mime_types_map[type];
 }
@@ -0,0 +1,24 @@
+// Progress messages on stdout. Errors keep going to stderr and are never silenced.
+
+#include <stdarg.h>
+
+static int log_quiet;   // set once from the command line, before any worker starts
+
+void log_set_quiet(int quiet) {
+    log_quiet = quiet;
+}
+
+// One call writes one whole line, so lines from concurrent writers never interleave.
+void log_info(const char *fmt, ...) {
+    char line[1024];
+    va_list ap;
+
+    if (log_quiet)
+        return;
+
+    va_start(ap, fmt);
+    vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+
+    fputs(line, stdout);
+}
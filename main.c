@@ -7,10 +7,20 @@
 #include <time.h>
 #include <pthread.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/sysmacros.h>
 
 
+#include "log.c"
+#include "trace.c"
+#include "alloc.c"
+#include "pool.c"
+#include "arena.c"
 #include "wav.c"
 #include "ftype_detect.c"
+#include "mp3_tags.c"
 
 #define MINIMP3_ONLY_MP3
 #define MINIMP3_USE_SIMD
@@ -27,12 +37,19 @@
 
 
 #include "minimp3.h"
+#include "vbr_tag.c"
+#include "mp3_cut.c"
+#include "pcm_convert.c"
+#include "numa.c"
+#include "sched.c"
 
 typedef struct {
     size_t num_samples;
     size_t channels;
     void *samples;
     float sample_rate;
+    const uint8_t *mapped;      // file samples points into, or NULL if samples is allocated
+    uint64_t mapped_size;
 } audio_data;
 
 
@@ -43,6 +60,15 @@ typedef struct {
 
 #define AUTO_MODE "AUTO"
 #define MAX_FILENAME 256
+#define DECODE_CHUNK_FRAMES 256
+#define SLICE_INLINE_BYTES (1 << 20)    // all slices together below this are written on the calling thread
+#define SLICE_BATCH_BYTES  (1 << 20)    // smaller slices are grouped into tasks of about this size
+#define SLICE_ROTATIONAL_STREAMS 2      // tasks writing at once to a spinning disk
+#define PLACE_CHUNK_BYTES  (4 << 20)    // buffer faulted in per task by place_on_nodes()
+#define RELEASE_GRANULE    ((uint64_t)2 << 20)  // largest page cache folio a fault maps at once
+
+#include "perf_counters.c"
+#include "stats.c"
 
 typedef enum {
     CUSTOM_MODE,
@@ -51,56 +77,154 @@ typedef enum {
 } split_mode_t;
 
 
+typedef enum {
+    OUTPUT_WAV,
+    OUTPUT_MP3
+} output_format_t;
+
+typedef struct {
+    int ch_mode;              // MP3D_CH_* output channel selection
+    output_format_t output;   // OUTPUT_MP3 copies frames instead of decoding
+    int gapless;              // trim MP3 encoder delay/padding given by a LAME tag
+    int quiet;                // no progress lines on stdout
+    int stats_json;           // print run statistics as JSON on stdout when done
+    int counters;             // add hardware counters to the statistics
+    const char *trace_file;   // Chrome trace JSON written at exit, NULL for none
+    int probe;                // print header information of the positional paths instead of cutting
+    int pin;                  // pin workers to CPUs and place buffers per NUMA node
+    int huge_pages;           // back large pool buffers with transparent huge pages
+    uint64_t max_memory;      // bytes of audio and slice buffers, 0 for no limit
+} options_t;
+
+
+// One MP3 decode: owns its decoder state, the input mapping and the output buffer, so any
+// number of sessions can run on different threads at once.
+typedef struct {
+    mp3dec_t dec;
+    const uint8_t *input;       // mapped input file
+    uint64_t input_size;
+    const uint8_t *pos;         // next frame
+    uint64_t remaining;         // bytes left before trailing tags
+    vbr_tag_t tag;
+    int ch_mode;
+    uint64_t to_skip;           // gapless trim still to drop, samples per channel
+    uint64_t trim_end;
+    uint64_t decoded;           // samples per channel decoded so far
+    uint64_t base;              // of those, dropped from the front of audio.samples (windowed)
+    uint64_t expected;          // samples per channel the headers announce, after trimming
+    size_t capacity;            // audio.samples size in samples
+    int fixed_capacity;         // others read audio.samples while it fills, so it must not move
+    audio_data audio;
+} mp3_session_t;
+
 typedef struct {
-    audio_data *audio;
+    const audio_data *audio;
     float lengths[2];
-    char output_str[MAX_FN_LENGTH];
+    const char *path;           // output file, in the plan's arena
+    uint64_t available;         // samples of audio the slice may use; later ones may still be decoding
+    const run_stats_t *run;
+    slice_stats_t *stats;
 } thread_args_t;
 
+typedef struct {
+    const uint8_t *buf;
+    const mp3_index_t *index;
+    float lengths[2];
+    const char *path;
+    const run_stats_t *run;
+    slice_stats_t *stats;
+} mp3_thread_args_t;
 
 
-void read_file(const char *filename, uint64_t *size, uint8_t **data) {
-    *size = 0;
-    *data = NULL;
 
-    FILE *fin = fopen(filename, "rb");
-    
-    if (!fin) {
-        printf("\nError opening input file\n");
-        perror("fopen");
+void select_channels(W_D_TYPE *samples, size_t frames, size_t *channels, int ch_mode) {
+    size_t nch = *channels;
+
+    if (ch_mode == MP3D_CH_NATIVE || nch < 2)
         return;
+
+    size_t pick  = (ch_mode == MP3D_CH_RIGHT) ? 1 : 0;
+    float  scale = 1.0f / nch;
+
+    for (size_t i = 0; i < frames; i++) {
+        const W_D_TYPE *in = samples + i * nch;
+
+        if (ch_mode == MP3D_CH_MONO) {
+            float sum = 0;
+            for (size_t c = 0; c < nch; c++)
+                sum += in[c];
+            samples[i] = (W_D_TYPE)(sum * scale);
+        } else {
+            samples[i] = in[pick];
+        }
+    }
+
+    *channels = 1;
+}
+
+const uint8_t *map_file(const char *filename, uint64_t *size) {
+    *size = 0;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("open");
+        return NULL;
     }
 
     struct stat st;
-    if (fstat(fileno(fin), &st) != 0) {
+    if (fstat(fd, &st) != 0) {
         perror("fstat");
-        fclose(fin);
-        return;
+        close(fd);
+        return NULL;
     }
 
-    *size = (uint64_t)st.st_size;
+    if (st.st_size == 0) {
+        fprintf(stderr, "%s: empty file\n", filename);
+        close(fd);
+        return NULL;
+    }
 
-    *data = malloc(*size);
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
 
-    if (!*data) {
-        fprintf(stderr, "Memory allocation failed\n");
-        *size = 0;
-        fclose(fin);
-        return;
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
     }
 
-    if (fread(*data, 1, *size, fin) != *size) {
-        perror("fread");
-        free(*data);
-        *data = NULL;
-        *size = 0;
-    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    *size = (uint64_t)st.st_size;
+    return data;
+}
+
+void unmap_file(const uint8_t *data, uint64_t size) {
+    if (data)
+        munmap((void *)data, size);
+}
 
-    fclose(fin);
+// Lets go of the pages of map, a file mapping of size bytes, that a pass through the file has
+// left behind: from offset from up to the granule holding offset to, or up to to itself once
+// the pass is through. They stay in the page cache for anyone to read again, but no longer
+// count as this process's memory. A fault maps a whole page cache folio, up to a granule of
+// the file, so only whole granules are let go: a partly released one would be mapped back in
+// by the next read from it. Returns where the next release starts.
+uint64_t release_mapped(const uint8_t *map, uint64_t size, uint64_t from, uint64_t to, int through) {
+    uint64_t start = from / RELEASE_GRANULE * RELEASE_GRANULE;
+    uint64_t end   = through ? MINIMP3_MIN((to + RELEASE_GRANULE - 1) / RELEASE_GRANULE * RELEASE_GRANULE, size)
+                             : to / RELEASE_GRANULE * RELEASE_GRANULE;
+
+    if (end <= start)
+        return from;
+
+    madvise((void *)(map + start), end - start, MADV_DONTNEED);
+    return end;
 }
 
+#include "probe.c"
+
 
-audio_data read_wav(const char *filename){
+// For WAV encodings wav_parse() does not handle (ADPCM, A-law, ...).
+audio_data read_wav_sndfile(const char *filename, int ch_mode) {
 
     audio_data audio = {0};
     
@@ -114,19 +238,25 @@ audio_data read_wav(const char *filename){
     }
 
     audio.num_samples = (size_t)sf_info.frames * sf_info.channels;
-    audio.samples     = (float*)malloc(audio.num_samples * sizeof(float));
+    audio.samples     = (W_D_TYPE*)pool_alloc(audio.num_samples * sizeof(W_D_TYPE));
 
     if (!audio.samples) {
         fprintf(stderr, "Memory allocation failed\n");
-        free(audio.samples);
+        pool_free(audio.samples);
         audio.samples = NULL;
         sf_close(file);
         return audio ;
     }
 
-    if (sf_readf_float(file,audio.samples, sf_info.frames) < sf_info.frames) {
+#ifdef MINIMP3_FLOAT_OUTPUT
+    sf_count_t read = sf_readf_float(file, audio.samples, sf_info.frames);
+#else
+    sf_count_t read = sf_readf_short(file, audio.samples, sf_info.frames);
+#endif
+
+    if (read < sf_info.frames) {
         fprintf(stderr, "Error reading audio data\n");
-        free(audio.samples);
+        pool_free(audio.samples);
         audio.samples = NULL;
         sf_close(file);
         return audio ;
@@ -135,167 +265,1187 @@ audio_data read_wav(const char *filename){
     audio.sample_rate = sf_info.samplerate;
     audio.channels    = sf_info.channels;
 
+    select_channels(audio.samples, sf_info.frames, &audio.channels, ch_mode);
+    audio.num_samples = (size_t)sf_info.frames * audio.channels;
+
     sf_close(file);
 
     return audio;
 }
 
-audio_data read_mp3(char *input_filename) {
-    
-    audio_data audio  = {0};
+// A WAV input opened for slicing: the header is parsed up front, the samples are loaded once
+// the slices are known, and only the frames they cover are ever read.
+typedef struct {
+    const uint8_t *buf;         // mapped file, NULL once handed to audio_data or for libsndfile input
+    uint64_t size;
+    wav_info_t info;
+    int ch_mode;
+    int in_place;               // audio.samples points into the mapping
+} wav_input_t;
+
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+} frame_range_t;
+
+#define WAV_CONVERT_BLOCK_BYTES      (256 * 1024)
+#define WAV_CONVERT_PARALLEL_SAMPLES (1 << 20)
+#define WAV_CONVERT_SCRATCH_SAMPLES  4096
 
-    static mp3dec_t mp3d;
-    mp3dec_init(&mp3d);
+// Blocks of the merged ranges, one task each.
+typedef struct {
+    const wav_input_t *in;
+    W_D_TYPE *out;
+    size_t channels;            // output channels
+    const frame_range_t *ranges;
+    size_t n;
+    uint64_t block_frames;
+    uint64_t first_block[MAX_SLICES + 1];   // index of each range's first block; [n] is the total
+    atomic_int failed;
+} wav_convert_job_t;
+
+
+static int compare_frame_ranges(const void *a, const void *b) {
+    const frame_range_t *x = a, *y = b;
+    return (x->start > y->start) - (x->start < y->start);
+}
 
-    uint64_t buf_size  = 0;
-    uint8_t *input_buf = NULL;
+// Frames each slice copies, computed as the writers do, sorted and merged. Returns the count.
+static size_t slice_frame_ranges(const audio_data *audio, float lengths[][2], unsigned short count, uint64_t frames, frame_range_t *ranges) {
+    size_t n = 0;
 
-    read_file(input_filename, &buf_size, &input_buf);
+    for (unsigned short i = 0; i < count; i++) {
+        uint64_t start = (uint64_t)(lengths[i][0] * audio->sample_rate);
+        uint64_t end   = MINIMP3_MIN((uint64_t)(lengths[i][1] * audio->sample_rate), frames);
 
-    if (!input_buf) {
-        fprintf(stderr, "Failed to read input file: %s\n", input_filename);
-        return audio;
+        if (start < end)
+            ranges[n++] = (frame_range_t){ start, end };
     }
 
-    size_t data_size       = sizeof(W_D_TYPE);
-    size_t max_pcm_samples = (buf_size * MINIMP3_MAX_SAMPLES_PER_FRAME) / 128; // (mp3 max size estimate)
-    size_t pcm_bsiz        = max_pcm_samples * data_size * 2;
+    qsort(ranges, n, sizeof(*ranges), compare_frame_ranges);
 
-    audio.samples = malloc(pcm_bsiz);
-    if (!audio.samples) {
+    size_t merged = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (merged && ranges[i].start <= ranges[merged - 1].end)
+            ranges[merged - 1].end = MINIMP3_MAX(ranges[merged - 1].end, ranges[i].end);
+        else
+            ranges[merged++] = ranges[i];
+    }
+
+    return merged;
+}
+
+// Converts frames of the input from frame f on into out, which has room for them in the
+// output's channels. Returns 0, or -1 without memory.
+static int wav_convert_frames(const wav_input_t *in, W_D_TYPE *out, size_t out_channels, uint64_t f, size_t frames) {
+    const wav_info_t *info = &in->info;
+    size_t nch             = info->channels;
+    const uint8_t *src     = in->buf + info->data_offset + f * info->block_align;
+
+    if (out_channels == nch) {
+        pcm_to_output(out, src, info, frames * nch);
+    } else {
+        // channel selection needs every input channel first, a few frames at a time
+        W_D_TYPE stack[WAV_CONVERT_SCRATCH_SAMPLES];
+        W_D_TYPE *scratch = stack;
+        size_t step       = WAV_CONVERT_SCRATCH_SAMPLES / nch;
+
+        if (!step) {
+            step = 1;
+            if (!(scratch = mem_alloc(nch * sizeof(W_D_TYPE)))) {
+                fprintf(stderr, "Memory allocation failed\n");
+                return -1;
+            }
+        }
+
+        for (size_t done = 0; done < frames; done += step) {
+            size_t part     = MINIMP3_MIN(step, frames - done);
+            size_t channels = nch;
+
+            pcm_to_output(scratch, src + done * info->block_align, info, part * nch);
+            select_channels(scratch, part, &channels, in->ch_mode);
+            memcpy(out + done, scratch, part * sizeof(W_D_TYPE));
+        }
+
+        if (scratch != stack)
+            mem_free(scratch);
+    }
+
+    return 0;
+}
+
+// Converts block b of the ranges. Each block is written by the worker that converted it, so on
+// NUMA machines its pages of the still untouched output end up local to the core that filled them.
+static void wav_convert_block(void *arg, size_t b) {
+    wav_convert_job_t *job = arg;
+    size_t r               = 0;
+    double t               = trace_begin();
+
+    while (b >= job->first_block[r + 1])
+        r++;
+
+    uint64_t f    = job->ranges[r].start + (b - job->first_block[r]) * job->block_frames;
+    size_t frames = (size_t)MINIMP3_MIN(job->ranges[r].end - f, job->block_frames);
+
+    if (wav_convert_frames(job->in, job->out + f * job->channels, job->channels, f, frames) != 0)
+        atomic_store(&job->failed, 1);
+
+    trace_end_arg("convert", "block", t, "frames", frames);
+}
+
+// Parses the header and sizes audio for the whole file without reading samples. Samples
+// already stored as W_D_TYPE stay in the mapping; otherwise a buffer is reserved, which costs
+// no memory until wav_input_load() writes to it. libsndfile input is read completely here.
+int wav_input_open(wav_input_t *in, audio_data *audio, const char *filename, int ch_mode) {
+    memset(in, 0, sizeof(*in));
+    memset(audio, 0, sizeof(*audio));
+
+    in->buf = map_file(filename, &in->size);
+    if (!in->buf)
+        return -1;
+
+    if (wav_parse(in->buf, in->size, &in->info) != 0) {
+        unmap_file(in->buf, in->size);
+        in->buf = NULL;
+        *audio  = read_wav_sndfile(filename, ch_mode);
+        return audio->samples ? 0 : -1;
+    }
+
+    // the slices decide what is read, not readahead from the start of the file
+    madvise((void *)in->buf, in->size, MADV_RANDOM);
+
+    const wav_info_t *info = &in->info;
+    const uint8_t *data    = in->buf + info->data_offset;
+    int keep_channels      = ch_mode == MP3D_CH_NATIVE || info->channels < 2;
+
+    in->ch_mode       = ch_mode;
+    audio->sample_rate = info->sample_rate;
+    audio->channels    = keep_channels ? info->channels : 1;
+    audio->num_samples = (size_t)info->frames * audio->channels;
+
+    if (pcm_is_output_format(info) && keep_channels && (uintptr_t)data % sizeof(W_D_TYPE) == 0) {
+        // read-only: the writers only copy out of it
+        audio->samples     = (void *)data;
+        audio->mapped      = in->buf;
+        audio->mapped_size = in->size;
+        in->in_place       = 1;
+        return 0;
+    }
+
+    audio->samples = pool_alloc(audio->num_samples * sizeof(W_D_TYPE));
+    if (!audio->samples) {
         fprintf(stderr, "Memory allocation failed\n");
-        free(input_buf);
+        unmap_file(in->buf, in->size);
+        in->buf = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+// All ranges are requested from the kernel at once so their reads overlap, then converted
+// block by block where needed. Returns the frames loaded.
+static uint64_t wav_input_load_ranges(wav_input_t *in, audio_data *audio, const frame_range_t *ranges, size_t n) {
+    const wav_info_t *info = &in->info;
+    const uint8_t *data    = in->buf + info->data_offset;
+    uintptr_t page         = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uint64_t loaded = 0;
+
+    for (size_t r = 0; r < n; r++) {
+        uintptr_t first = (uintptr_t)(data + ranges[r].start * info->block_align) & ~(page - 1);
+        uintptr_t last  = (uintptr_t)(data + ranges[r].end * info->block_align);
+        madvise((void *)first, last - first, MADV_WILLNEED);
+        loaded += ranges[r].end - ranges[r].start;
+    }
+
+    if (in->in_place)
+        return loaded;
+
+    wav_convert_job_t job;
+    memset(&job, 0, sizeof(job));
+
+    job.in       = in;
+    job.out      = audio->samples;
+    job.ranges   = ranges;
+    job.n        = n;
+    job.channels = audio->channels;
+
+    // input and output of a block together fit in a per-core cache
+    job.block_frames = MINIMP3_MAX(256, WAV_CONVERT_BLOCK_BYTES / (info->block_align + job.channels * sizeof(W_D_TYPE)));
+
+    for (size_t r = 0; r < n; r++)
+        job.first_block[r + 1] = job.first_block[r] + (ranges[r].end - ranges[r].start + job.block_frames - 1) / job.block_frames;
+
+    sched_group_t group = { 0 };
+    uint64_t blocks     = job.first_block[n];
+
+    // handing out blocks pays off only past a few of them
+    if (loaded * info->channels < WAV_CONVERT_PARALLEL_SAMPLES) {
+        for (uint64_t b = 0; b < blocks; b++)
+            wav_convert_block(&job, b);
+    } else {
+        // a block goes to the node its slices will be written from, see async_sliced_write_wave()
+        for (size_t r = 0; r < n; r++) {
+            for (uint64_t b = job.first_block[r]; b < job.first_block[r + 1]; b++) {
+                uint64_t f = ranges[r].start + (b - job.first_block[r]) * job.block_frames;
+                sched_submit_node(&group, wav_convert_block, &job, b, sched_node_of(f, info->frames));
+            }
+        }
+        sched_wait(&group);
+    }
+
+    return atomic_load(&job.failed) ? 0 : loaded;
+}
+
+// Reads the frames the slices cover, and nothing else. Returns the frames loaded.
+uint64_t wav_input_load(wav_input_t *in, audio_data *audio, float lengths[][2], unsigned short count) {
+    frame_range_t ranges[MAX_SLICES];
+
+    if (!in->buf)
+        return audio->num_samples / MINIMP3_MAX(audio->channels, 1);
+
+    size_t n = slice_frame_ranges(audio, lengths, count, in->info.frames, ranges);
+    return wav_input_load_ranges(in, audio, ranges, n);
+}
+
+// Bytes of audio.samples that wav_input_load() would fill for the slices.
+uint64_t wav_input_load_bytes(const wav_input_t *in, const audio_data *audio, float lengths[][2], unsigned short count) {
+    frame_range_t ranges[MAX_SLICES];
+    uint64_t frames = 0;
+
+    if (!in->buf || in->in_place)
+        return 0;
+
+    size_t n = slice_frame_ranges(audio, lengths, count, in->info.frames, ranges);
+    for (size_t r = 0; r < n; r++)
+        frames += ranges[r].end - ranges[r].start;
+
+    return frames * audio->channels * sizeof(W_D_TYPE);
+}
+
+void wav_input_close(wav_input_t *in) {
+    if (in->buf && !in->in_place)
+        unmap_file(in->buf, in->size);
+    memset(in, 0, sizeof(*in));
+}
+
+// The whole file, for callers that don't slice (benchmark/bench.c).
+audio_data read_wav(const char *filename, int ch_mode) {
+    audio_data audio;
+    wav_input_t in;
+
+    if (wav_input_open(&in, &audio, filename, ch_mode) != 0)
         return audio;
+
+    if (in.buf) {
+        frame_range_t whole = { 0, in.info.frames };
+        wav_input_load_ranges(&in, &audio, &whole, 1);
+    }
+    wav_input_close(&in);
+    return audio;
+}
+
+void free_audio_data(audio_data *audio) {
+    if (audio->mapped)
+        unmap_file(audio->mapped, audio->mapped_size);
+    else
+        pool_free(audio->samples);
+    memset(audio, 0, sizeof(*audio));
+}
+
+void mp3_session_close(mp3_session_t *s) {
+    pool_free(s->audio.samples);
+    unmap_file(s->input, s->input_size);
+    memset(s, 0, sizeof(*s));
+}
+
+int mp3_session_open(mp3_session_t *s, const char *filename, int ch_mode, int gapless) {
+    memset(s, 0, sizeof(*s));
+    mp3dec_init(&s->dec);
+    s->ch_mode = ch_mode;
+
+    s->input = map_file(filename, &s->input_size);
+
+    if (!s->input) {
+        fprintf(stderr, "Failed to read input file: %s\n", filename);
+        return -1;
+    }
+
+    // ID3/APE tags are stepped over, not scanned for frame sync
+    uint64_t range_start, range_end;
+    mp3_audio_range(s->input, s->input_size, &range_start, &range_end);
+
+    // the tag frame is skipped, not decoded: it would come out as a frame of silence
+    int64_t audio_start = find_vbr_tag(s->input + range_start, range_end - range_start, &s->tag);
+
+    if (audio_start < 0) {
+        fprintf(stderr, "No MPEG audio frames found in %s\n", filename);
+        mp3_session_close(s);
+        return -1;
+    }
+
+    s->pos       = s->input + range_start + audio_start;
+    s->remaining = range_end - range_start - audio_start;
+
+    if (gapless)
+        vbr_tag_trim(&s->tag, &s->to_skip, &s->trim_end);
+
+    // a frame count from the tag sizes the buffer; without one, walking the frame headers is
+    // far cheaper than decoding them. Frames the decoder can't rebuild only make it smaller.
+    uint64_t frame_samples = s->tag.frames ? (uint64_t)s->tag.frames * s->tag.frame_samples
+                                           : mp3_count_samples(s->pos, 0, s->remaining, NULL);
+
+    s->expected = frame_samples > s->to_skip + s->trim_end ? frame_samples - s->to_skip - s->trim_end : frame_samples;
+    s->capacity = (frame_samples + s->tag.frame_samples) * s->tag.channels;
+
+    s->audio.samples = pool_alloc(s->capacity * sizeof(W_D_TYPE));
+
+    if (!s->audio.samples) {
+        fprintf(stderr, "Memory allocation failed\n");
+        mp3_session_close(s);
+        return -1;
     }
 
-    W_D_TYPE *full_pcm = (W_D_TYPE *)audio.samples; 
+    return 0;
+}
 
-    uint64_t decoded_samples = 0;
-    size_t remaining_size = buf_size;
+// Decodes up to max_frames more frames into the session buffer. Returns the number of
+// frames consumed, 0 once the input is exhausted, -1 on error.
+int mp3_session_decode(mp3_session_t *s, size_t max_frames) {
+    size_t frames = 0;
 
-    while (remaining_size > 0) {
+    while (s->remaining > 0 && frames < max_frames) {
         mp3dec_frame_info_t info;
         W_D_TYPE pcm[MINIMP3_MAX_SAMPLES_PER_FRAME * 2];
 
-        int samples = mp3dec_decode_frame(&mp3d, input_buf, remaining_size, pcm, &info);
+        int samples = mp3dec_decode_frame_ch(&s->dec, s->pos, s->remaining, pcm, &info, s->ch_mode);
 
-        if (info.frame_bytes == 0 || remaining_size < info.frame_bytes) {
+        if (info.frame_bytes == 0 || s->remaining < (uint64_t)info.frame_bytes) {
+            s->remaining = 0;
             break;
         }
 
-        if (samples > 0) {
-            if ((decoded_samples + samples) * 2 > max_pcm_samples) {
-                fprintf(stderr, "PCM buffer overflow prevented\n");
+        s->pos       += info.frame_bytes;
+        s->remaining -= info.frame_bytes;
+        frames++;
+
+        if (samples <= 0)
+            continue;
+
+        s->audio.channels    = info.channels;
+        s->audio.sample_rate = info.hz;
+
+        // encoder delay and decoder latency
+        if ((uint64_t)samples <= s->to_skip) {
+            s->to_skip -= samples;
+            continue;
+        }
+
+        const W_D_TYPE *src = pcm + s->to_skip * info.channels;
+        samples   -= (int)s->to_skip;
+        s->to_skip = 0;
+
+        size_t used = (s->decoded - s->base) * info.channels;
+
+        if (used + (size_t)samples * info.channels > s->capacity) {
+            if (s->fixed_capacity) {
+                fprintf(stderr, "Stream has more frames than its header announced; the rest is dropped\n");
+                s->remaining = 0;
                 break;
             }
 
-            size_t copy_size = samples * data_size * info.channels;
-            memcpy(full_pcm + (decoded_samples * info.channels), pcm, copy_size);
+            size_t grown_samples = s->capacity + s->capacity / 2 + MINIMP3_MAX_SAMPLES_PER_FRAME * 2;
+            void  *grown         = pool_realloc(s->audio.samples, grown_samples * sizeof(W_D_TYPE));
 
-            audio.channels = info.channels;
-            audio.sample_rate = info.hz;
-            decoded_samples += samples;
+            if (!grown) {
+                fprintf(stderr, "Memory allocation failed\n");
+                return -1;
+            }
+            s->audio.samples = grown;
+            s->capacity      = grown_samples;
         }
 
-        input_buf += info.frame_bytes;
-        remaining_size -= info.frame_bytes;
+        memcpy((W_D_TYPE *)s->audio.samples + used, src, samples * sizeof(W_D_TYPE) * info.channels);
+        s->decoded += samples;
     }
 
-    audio.num_samples = decoded_samples;
+    return (int)frames;
+}
+
+// Decodes into a window of bytes from now on instead of a buffer for the whole stream; the
+// caller makes room with mp3_session_drop(). Returns the window's size in samples per channel
+// (0 if no memory), enough for at least a few frames.
+uint64_t mp3_session_window(mp3_session_t *s, size_t bytes, int channels) {
+    size_t samples = MINIMP3_MAX(bytes / sizeof(W_D_TYPE), (s->trim_end + 8 * MINIMP3_MAX_SAMPLES_PER_FRAME) * channels);
+
+    pool_free(s->audio.samples);
+    s->audio.samples  = pool_alloc(samples * sizeof(W_D_TYPE));
+    s->capacity       = s->audio.samples ? samples : 0;
+    s->fixed_capacity = 1;
+
+    if (!s->audio.samples)
+        fprintf(stderr, "Memory allocation failed\n");
+    return s->capacity / channels;
+}
 
+// Forgets the samples before upto (per channel), moving the rest to the front of the window.
+void mp3_session_drop(mp3_session_t *s, uint64_t upto) {
+    size_t channels   = MINIMP3_MAX(s->audio.channels, 1);
+    W_D_TYPE *samples = s->audio.samples;
+
+    memmove(samples, samples + (upto - s->base) * channels, (s->decoded - upto) * channels * sizeof(W_D_TYPE));
+    s->base = upto;
+}
+
+// Hands the decoded audio over to the caller and closes the session.
+audio_data mp3_session_finish(mp3_session_t *s) {
+    audio_data audio = s->audio;
+
+    // encoder padding; skipped if the stream is too short for it to make sense
+    uint64_t decoded = s->decoded > s->trim_end ? s->decoded - s->trim_end : s->decoded;
+    audio.num_samples = decoded * audio.channels;
+
+    s->audio.samples = NULL;
+    mp3_session_close(s);
     return audio;
 }
 
-void *write_wave_thread(void *arg) {
-    thread_args_t *args    = (thread_args_t *)arg;
-    audio_data *audio      = args->audio;
+// stats is optional; opening the session counts as the read stage, the rest as decode.
+audio_data read_mp3(const char *input_filename, int ch_mode, int gapless, run_stats_t *stats) {
+    audio_data audio = {0};
+    mp3_session_t session;
+    double t = stats_now();
+
+    if (mp3_session_open(&session, input_filename, ch_mode, gapless) != 0)
+        return audio;
+
+    if (stats)
+        t = stats_stage(stats, STATS_READ, t);
+
+    // chunks only set the granularity of the trace; decoding itself does not care
+    int rc;
+    double chunk = trace_begin();
+    while ((rc = mp3_session_decode(&session, DECODE_CHUNK_FRAMES)) > 0) {
+        trace_end_arg("decode", "decode chunk", chunk, "frames", rc);
+        chunk = trace_begin();
+        if (stats)
+            stats->frames_decoded += rc;
+    }
+
+    if (stats)
+        stats_stage(stats, STATS_DECODE, t);
+
+    if (rc < 0) {
+        mp3_session_close(&session);
+        return audio;
+    }
+
+    return mp3_session_finish(&session);
+}
+
+void write_wave_slice(thread_args_t *args) {
+    const audio_data *audio = args->audio;
     float *lengths         = args->lengths;
-    char *output_str       = args->output_str;
     size_t data_size       = sizeof(W_D_TYPE);
+    stats_timer_t timer;
+
+    stats_slice_begin(args->run, args->stats, &timer);
 
     uint64_t start_sample  = (uint64_t)(lengths[0] * audio->sample_rate) * audio->channels;
     uint64_t end_sample    = (uint64_t)(lengths[1] * audio->sample_rate) * audio->channels;
+
+    if (end_sample > args->available)
+        end_sample = args->available;
+
+    if (start_sample >= end_sample) {
+        fprintf(stderr, "Invalid time range for %s: [%f, %f]\n", args->path, lengths[0], lengths[1]);
+        stats_slice_end(args->run, args->stats, &timer, 0, 0);
+        return;
+    }
+
     uint64_t slice_samples = end_sample - start_sample;
 
-    W_D_TYPE *slice = malloc(slice_samples * data_size);
+    double t = trace_begin();
+    W_D_TYPE *slice = pool_alloc(slice_samples * data_size);
 
     if (!slice) {
         fprintf(stderr, "Memory allocation failed for slice\n"); // Removed slice number
-        pthread_exit(NULL);
-        return NULL;  
+        stats_slice_end(args->run, args->stats, &timer, 0, 0);
+        return;
     }
 
     memcpy(slice, (W_D_TYPE *)audio->samples + start_sample, slice_samples * data_size);
-    char output_filename[780];
-    snprintf(output_filename, sizeof(output_filename), "%s.wav", output_str);
+    trace_end_arg("copy", "slice copy", t, "bytes", slice_samples * data_size);
+
+    int rc = write_wave(args->path, slice, slice_samples /audio->channels, audio->channels, audio->sample_rate);
+
+    pool_free(slice);
+
+    if (rc == 0)
+        stats_slice_end(args->run, args->stats, &timer, sizeof(wav_header) + slice_samples * data_size, slice_samples);
+    else
+        stats_slice_end(args->run, args->stats, &timer, 0, 0);
+}
+
+typedef struct {
+    uint8_t *base;
+    size_t bytes;
+} place_job_t;
+
+static void place_chunk(void *arg, size_t i) {
+    const place_job_t *job = arg;
+    size_t page            = (size_t)sysconf(_SC_PAGESIZE);
+    size_t end             = MINIMP3_MIN((i + 1) * PLACE_CHUNK_BYTES, job->bytes);
+
+    // one write per page is what faults it in, on the node of the worker doing it
+    for (size_t at = i * PLACE_CHUNK_BYTES; at < end; at += page)
+        job->base[at] = 0;
+}
+
+// With workers pinned across NUMA nodes, faults in the untouched buffer buf part by part from
+// the node that sched_node_of() gives each part, so its pages are local to the workers that
+// will be handed that part. Does nothing otherwise.
+static void place_on_nodes(void *buf, size_t bytes) {
+    if (sched_node_of(0, 1) < 0)
+        return;
+
+    place_job_t job     = { buf, bytes };
+    sched_group_t group = { 0 };
+    double t            = trace_begin();
+
+    for (size_t i = 0; i * PLACE_CHUNK_BYTES < bytes; i++)
+        sched_submit_node(&group, place_chunk, &job, i, sched_node_of(i * PLACE_CHUNK_BYTES, bytes));
+    sched_wait(&group);
+
+    trace_end_arg("numa", "place buffer", t, "bytes", bytes);
+}
+
+// How a set of slices is run, from what each costs to write.
+typedef struct {
+    int inline_all;             // in order on the calling thread, without waking the pool
+    int batches;                // tasks otherwise; batch b is slices first[b] to first[b + 1] - 1
+    unsigned short first[MAX_SLICES + 1];
+} slice_plan_t;
+
+typedef struct {
+    const slice_plan_t *plan;
+    sched_fn fn;
+    void *arg;
+} slice_batch_job_t;
+
+
+// 1 if the directory of path is on a spinning disk, where many parallel writes only add seeks;
+// 0 on SSDs and on anything /sys/dev/block does not describe (tmpfs, network file systems).
+static int output_is_rotational(const char *path) {
+    // a partition has no queue of its own; its disk is the directory above
+    static const char *queues[] = { "queue/rotational", "../queue/rotational" };
+    char dir[MAX_FN_LENGTH], sys[128];
+    struct stat st;
 
-    write_wave(output_filename, slice, slice_samples /audio->channels, audio->channels, audio->sample_rate);
+    snprintf(dir, sizeof(dir), "%s", path);
+    char *slash = strrchr(dir, '/');
+    if (!slash)
+        strcpy(dir, ".");
+    else if (slash == dir)
+        dir[1] = '\0';
+    else
+        *slash = '\0';
+
+    if (stat(dir, &st) != 0)
+        return 0;
+
+    for (int i = 0; i < 2; i++) {
+        snprintf(sys, sizeof(sys), "/sys/dev/block/%u:%u/%s", major(st.st_dev), minor(st.st_dev), queues[i]);
+
+        FILE *f = fopen(sys, "r");
+        if (f) {
+            int c = fgetc(f);
+            fclose(f);
+            return c == '1';
+        }
+    }
 
-    free(slice);
-    pthread_exit(NULL);
-    return NULL;
+    return 0;
 }
 
-void async_sliced_write_wave(audio_data *audio, float lengths[][2], unsigned short length, char output_strs[][MAX_FN_LENGTH]) {
+// Small jobs run inline: waking workers would cost more than the writes. Otherwise slices are
+// grouped in order until a group holds SLICE_BATCH_BYTES, so big slices are tasks of their own
+// and small ones share one. On a spinning disk the groups are made big enough that there are
+// only SLICE_ROTATIONAL_STREAMS of them, each writing its files one after another.
+// bytes[] is what each slice writes; output is the name of any of them.
+static void plan_slices(slice_plan_t *plan, const uint64_t bytes[], unsigned short count, const char *output) {
+    uint64_t total = 0, batch = 0;
+
+    for (unsigned short i = 0; i < count; i++)
+        total += bytes[i];
+
+    plan->batches    = 0;
+    plan->first[0]   = 0;
+    plan->inline_all = count < 2 || total < SLICE_INLINE_BYTES;
+
+    if (plan->inline_all)
+        return;
+
+    uint64_t target = SLICE_BATCH_BYTES;
+    if (output_is_rotational(output))
+        target = MINIMP3_MAX(target, (total + SLICE_ROTATIONAL_STREAMS - 1) / SLICE_ROTATIONAL_STREAMS);
+
+    for (unsigned short i = 0; i < count; i++) {
+        batch += bytes[i];
+        if (batch >= target || i == count - 1) {
+            plan->first[++plan->batches] = i + 1;
+            batch = 0;
+        }
+    }
+}
+
+static void run_slice_batch(void *arg, size_t b) {
+    const slice_batch_job_t *job = arg;
+
+    for (size_t i = job->plan->first[b]; i < job->plan->first[b + 1]; i++)
+        job->fn(job->arg, i);
+}
+
+// Runs fn(arg, i) for every slice as the plan says and returns once all are done. A batch runs
+// on the NUMA node of its first slice when node[] is given.
+static void run_slices(const slice_plan_t *plan, sched_fn fn, void *arg, unsigned short count, const int node[]) {
+    if (plan->inline_all) {
+        for (unsigned short i = 0; i < count; i++)
+            fn(arg, i);
+        return;
+    }
+
+    slice_batch_job_t job = { plan, fn, arg };
+    sched_group_t group   = { 0 };
+
+    for (int b = 0; b < plan->batches; b++)
+        sched_submit_node(&group, run_slice_batch, &job, b, node ? node[plan->first[b]] : -1);
+
+    double t = trace_begin();
+    sched_wait(&group);
+    trace_end("wait", "join writers", t);
+}
+
+// What write_wave_slice() will write for a slice, header included.
+static uint64_t wave_slice_bytes(const audio_data *audio, const float lengths[2], uint64_t available) {
+    uint64_t start = (uint64_t)(lengths[0] * audio->sample_rate) * audio->channels;
+    uint64_t end   = MINIMP3_MIN((uint64_t)(lengths[1] * audio->sample_rate) * audio->channels, available);
+
+    return end > start ? sizeof(wav_header) + (end - start) * sizeof(W_D_TYPE) : 0;
+}
+
+static void write_wave_task(void *arg, size_t slice) {
+    write_wave_slice((thread_args_t *)arg + slice);
+}
+
+void async_sliced_write_wave(audio_data *audio, float lengths[][2], unsigned short length, const char *paths[], run_stats_t *stats) {
 
     if(!audio->channels)
       audio->channels = 1;
 
-    pthread_t threads[length]; 
     thread_args_t thread_args[length];
-    
+    uint64_t bytes[MAX_SLICES] = { 0 };
+    int node[MAX_SLICES];
+    slice_plan_t plan;
 
     for (int i = 0; i < length; i++) {
         thread_args[i].audio = audio;
         memcpy(thread_args[i].lengths, lengths[i], sizeof(float) * 2);
-        strncpy(thread_args[i].output_str, output_strs[i], MAX_FN_LENGTH - 1); 
-        thread_args[i].output_str[MAX_FN_LENGTH - 1] = '\0'; 
+        thread_args[i].path  = paths[i];
+        thread_args[i].available = audio->num_samples;
+        thread_args[i].run   = stats;
+        thread_args[i].stats = &stats->slices[i];
 
-        int rc = pthread_create(&threads[i], NULL, write_wave_thread, &thread_args[i]);
-        if (rc) {
-            fprintf(stderr, "Error creating thread %d, return code is %d\n", i, rc);
-            break; 
-        }
+        bytes[i] = wave_slice_bytes(audio, lengths[i], audio->num_samples);
     }
 
+    plan_slices(&plan, bytes, length, length ? paths[0] : ".");
+
+    // where the converted samples were first touched; the page cache decides for a mapping
+    for (int i = 0; i < length && !plan.inline_all; i++)
+        node[i] = audio->mapped ? -1 : sched_node_of((uint64_t)(lengths[i][0] * audio->sample_rate) * audio->channels, audio->num_samples);
+
+    run_slices(&plan, write_wave_task, thread_args, length, plan.inline_all ? NULL : node);
+
+    stats->slice_count = length;
+}
+
+
+typedef struct {
+    uint64_t end;               // frame the slice must be decoded up to
+    int slice;
+} slice_end_t;
+
+
+static int compare_slice_ends(const void *a, const void *b) {
+    const slice_end_t *x = a, *y = b;
+    return (x->end > y->end) - (x->end < y->end);
+}
+
+// Decodes the session on this thread and hands each slice to the task pool as soon as the
+// decoder has passed its end, so writing overlaps decoding. With two writes per worker queued
+// the decoder runs writes itself until the pool catches up, so it never gets far ahead of what
+// the disk takes. When plan_slices() finds the job small, each slice is written right here
+// instead. A stream decodes strictly in order, so its chunks stay on this thread rather than
+// becoming tasks. The session's buffer is sized up front and never moves. On return audio
+// holds the decoded stream, as read_mp3() would give it.
+int decode_and_write_wave(mp3_session_t *s, audio_data *audio, float lengths[][2], unsigned short length, const char *paths[], run_stats_t *stats) {
+    // what the writers see: everything but the length, which is only final at the end
+    audio_data view = { 0 };
+    view.samples     = s->audio.samples;
+    view.sample_rate = s->tag.sample_rate;
+    view.channels    = s->ch_mode == MP3D_CH_NATIVE ? s->tag.channels : 1;
+
+    thread_args_t args[length];
+    slice_end_t order[length];
+    uint64_t bytes[MAX_SLICES] = { 0 };
+    int node[MAX_SLICES];
+    sched_group_t group = { 0 };
+    slice_plan_t plan;
+
     for (int i = 0; i < length; i++) {
-        pthread_join(threads[i], NULL);
+        args[i].audio = &view;
+        memcpy(args[i].lengths, lengths[i], sizeof(float) * 2);
+        args[i].path      = paths[i];
+        args[i].available = 0;
+        args[i].run   = stats;
+        args[i].stats = &stats->slices[i];
+
+        order[i].end   = (uint64_t)(lengths[i][1] * view.sample_rate);
+        order[i].slice = i;
+        bytes[i]       = wave_slice_bytes(&view, lengths[i], s->expected * view.channels);
+    }
+    qsort(order, length, sizeof(*order), compare_slice_ends);
+
+    // slices become ready one by one, so they are not batched
+    plan_slices(&plan, bytes, length, length ? paths[0] : ".");
+
+    long in_flight    = plan.inline_all ? 0 : 2L * MINIMP3_MAX(sched_size(), 1);
+    s->fixed_capacity = 1;
+
+    if (!plan.inline_all) {
+        // the decoder writes the buffer, but each slice is read by the node it was placed on
+        place_on_nodes(s->audio.samples, s->capacity * sizeof(W_D_TYPE));
+        for (int i = 0; i < length; i++)
+            node[i] = sched_node_of((uint64_t)(lengths[i][0] * view.sample_rate) * view.channels, s->capacity);
+    }
+
+    double t     = stats_now();
+    double chunk = trace_begin();
+    int next     = 0;
+    int rc;
+
+    while ((rc = mp3_session_decode(s, DECODE_CHUNK_FRAMES)) > 0) {
+        trace_end_arg("decode", "decode chunk", chunk, "frames", rc);
+        stats->frames_decoded += rc;
+
+        // the last trim_end samples decoded at any point may turn out to be padding
+        uint64_t ready = s->decoded > s->trim_end ? s->decoded - s->trim_end : 0;
+
+        while (next < length && order[next].end <= ready) {
+            if (plan.inline_all) {
+                args[order[next].slice].available = ready * view.channels;
+                write_wave_slice(&args[order[next++].slice]);
+                continue;
+            }
+
+            if (atomic_load(&group.pending) >= in_flight) {
+                double full = trace_begin();
+                sched_wait_until(&group, in_flight - 1);
+                trace_end("wait", "queue full", full);
+            }
+
+            args[order[next].slice].available = ready * view.channels;
+            sched_submit_node(&group, write_wave_task, args, order[next].slice, node[order[next].slice]);
+            next++;
+        }
+        chunk = trace_begin();
+    }
+
+    *audio = mp3_session_finish(s);
+    t = stats_stage(stats, STATS_DECODE, t);
+
+    // slices reaching past the end
+    for (; next < length; next++) {
+        args[order[next].slice].available = audio->num_samples;
+        if (plan.inline_all)
+            write_wave_slice(&args[order[next].slice]);
+        else
+            sched_submit_node(&group, write_wave_task, args, order[next].slice, node[order[next].slice]);
+    }
+
+    double wait = trace_begin();
+    sched_wait(&group);
+    trace_end("wait", "join writers", wait);
+
+    stats->slice_count = length;
+    stats_stage(stats, STATS_WRITE, t);
+
+    return rc < 0 ? -1 : 0;
+}
+
+// --max-memory: when the decoded audio would not fit the budget, slices are streamed to their
+// files as their samples come by. Only a window of the MP3 stream is held, or one block per
+// writer for WAV input, and the writers append straight from it instead of copying slices.
+typedef enum {
+    SLICE_STREAM_WAITING,       // no samples yet, the file is not open
+    SLICE_STREAM_OPEN,
+    SLICE_STREAM_DONE,
+    SLICE_STREAM_FAILED
+} slice_stream_state_t;
+
+typedef struct {
+    const char *path;
+    float lengths[2];
+    uint64_t start;             // interleaved samples of the input the slice covers
+    uint64_t end;
+    slice_stream_state_t state;
+    wav_stream_t out;
+    const run_stats_t *run;
+    slice_stats_t *stats;
+} slice_stream_t;
+
+typedef struct {
+    slice_stream_t *slices;
+    unsigned short active[MAX_SLICES];  // slices the window has samples for
+    const W_D_TYPE *samples;
+    uint64_t first;             // interleaved samples of the input in samples
+    uint64_t last;
+    int channels;
+    int sample_rate;
+} stream_window_t;
+
+typedef struct {
+    const wav_input_t *in;
+    const audio_data *audio;
+    slice_stream_t *slices;
+    uint64_t block_frames;
+} stream_wav_job_t;
+
+
+static void slice_stream_init(slice_stream_t *ss, const char *path, const float lengths[2], int sample_rate, int channels,
+                              const run_stats_t *run, slice_stats_t *stats) {
+    memset(ss, 0, sizeof(*ss));
+    memcpy(ss->lengths, lengths, sizeof(ss->lengths));
+
+    ss->path  = path;
+    ss->start = (uint64_t)(lengths[0] * sample_rate) * channels;
+    ss->end   = (uint64_t)(lengths[1] * sample_rate) * channels;
+    ss->run   = run;
+    ss->stats = stats;
+}
+
+static void slice_stream_close(slice_stream_t *ss) {
+    if (wav_stream_close(&ss->out, ss->path) == 0) {
+        ss->state = SLICE_STREAM_DONE;
+    } else {
+        ss->state = SLICE_STREAM_FAILED;
+        ss->stats->bytes   = 0;
+        ss->stats->samples = 0;
     }
 }
 
+// Appends what the slice covers of samples, the input's interleaved samples from first to last.
+// The file is opened with the first part and closed with the last.
+static void slice_stream_put(slice_stream_t *ss, const W_D_TYPE *samples, uint64_t first, uint64_t last, int channels, int sample_rate) {
+    uint64_t from = MINIMP3_MAX(ss->start, first);
+    uint64_t to   = MINIMP3_MIN(ss->end, last);
 
+    if (ss->state >= SLICE_STREAM_DONE || from >= to)
+        return;
 
-void sliced_write_wave(audio_data *audio, float lengths[][2], unsigned short length, char output_strs[][MAX_FN_LENGTH]) {
+    stats_timer_t timer;
+    int first_part = ss->state == SLICE_STREAM_WAITING;
+    uint64_t bytes = (to - from) * sizeof(W_D_TYPE);
 
-    size_t data_size = sizeof(W_D_TYPE);
-    
-    for (int i = 0; i < length; i++) {
-        if (lengths[i][0] < 0 || lengths[i][1] <= lengths[i][0] || 
-            lengths[i][1] > (float)audio->num_samples / audio->sample_rate) {
-            fprintf(stderr, "Invalid time range for slice %d: [%f, %f]\n", i + 1, lengths[i][0], lengths[i][1]);
-            continue;
+    stats_slice_begin(ss->run, ss->stats, &timer);
+
+    if (first_part) {
+        int format = sizeof(W_D_TYPE) == sizeof(float) ? WAV_FORMAT_FLOAT : WAV_FORMAT_PCM;
+
+        if (wav_stream_open(&ss->out, ss->path, format, channels, sample_rate, 8 * sizeof(W_D_TYPE)) != 0) {
+            ss->state = SLICE_STREAM_FAILED;
+            stats_slice_end(ss->run, ss->stats, &timer, 0, 0);
+            return;
+        }
+        ss->state = SLICE_STREAM_OPEN;
+        bytes    += sizeof(wav_header);
+    }
+
+    wav_stream_write(&ss->out, samples + (from - first), (to - from) * sizeof(W_D_TYPE));
+    stats_slice_add(ss->run, ss->stats, &timer, bytes, to - from, first_part);
+
+    if (to == ss->end)
+        slice_stream_close(ss);
+}
+
+// Once the input is through: closes a slice cut short by its end, and reports one that got
+// no samples at all, as write_wave_slice() does.
+static void slice_stream_finish(slice_stream_t *ss) {
+    if (ss->state == SLICE_STREAM_OPEN) {
+        slice_stream_close(ss);
+    } else if (ss->state == SLICE_STREAM_WAITING) {
+        stats_timer_t timer;
+
+        stats_slice_begin(ss->run, ss->stats, &timer);
+        fprintf(stderr, "Invalid time range for %s: [%f, %f]\n", ss->path, ss->lengths[0], ss->lengths[1]);
+        stats_slice_end(ss->run, ss->stats, &timer, 0, 0);
+        ss->state = SLICE_STREAM_FAILED;
+    }
+}
+
+static void stream_window_task(void *arg, size_t k) {
+    const stream_window_t *w = arg;
+    slice_stream_put(&w->slices[w->active[k]], w->samples, w->first, w->last, w->channels, w->sample_rate);
+}
+
+// Hands the window to every slice it has samples for, in parallel where plan_slices() finds
+// enough to write, and returns once all are written.
+static void stream_window(stream_window_t *w, unsigned short length, const char *output) {
+    uint64_t bytes[MAX_SLICES] = { 0 };
+    unsigned short n = 0;
+    slice_plan_t plan;
+
+    for (unsigned short i = 0; i < length; i++) {
+        const slice_stream_t *ss = &w->slices[i];
+        uint64_t from = MINIMP3_MAX(ss->start, w->first);
+        uint64_t to   = MINIMP3_MIN(ss->end, w->last);
+
+        if (ss->state < SLICE_STREAM_DONE && from < to) {
+            w->active[n] = i;
+            bytes[n++]   = (to - from) * sizeof(W_D_TYPE);
         }
+    }
+
+    plan_slices(&plan, bytes, n, output);
+    run_slices(&plan, stream_window_task, w, n, NULL);
+}
+
+// decode_and_write_wave() within window_bytes: the stream is decoded into a window, and each
+// time it is full what is ready goes out to the slices and the window starts over, so decoding
+// and writing take turns. On return audio describes the stream but holds no samples.
+int stream_and_write_wave(mp3_session_t *s, audio_data *audio, float lengths[][2], unsigned short length, const char *paths[],
+                          run_stats_t *stats, size_t window_bytes) {
+    slice_stream_t slices[length];
+    stream_window_t w = { 0 };
+
+    w.slices      = slices;
+    w.samples     = NULL;
+    w.sample_rate = s->tag.sample_rate;
+    w.channels    = s->ch_mode == MP3D_CH_NATIVE ? s->tag.channels : 1;
+
+    for (int i = 0; i < length; i++)
+        slice_stream_init(&slices[i], paths[i], lengths[i], w.sample_rate, w.channels, stats, &stats->slices[i]);
+
+    uint64_t window = mp3_session_window(s, window_bytes, w.channels);
+    if (!window) {
+        mp3_session_close(s);
+        return -1;
+    }
+
+    // counting frames without a VBR tag has read through all of the input
+    release_mapped(s->input, s->input_size, 0, s->input_size, 1);
+
+    const char *output = length ? paths[0] : ".";
+    uint64_t released  = 0;     // input pages before this are let go
+    double t           = stats_now();
+    double chunk       = trace_begin();
+    int rc;
 
-        uint64_t start_sample = (uint64_t)(lengths[i][0] * audio->sample_rate) * audio->channels;
-        uint64_t end_sample    = (uint64_t)(lengths[i][1] * audio->sample_rate) * audio->channels;
-        uint64_t slice_samples = end_sample - start_sample;
+    for (;;) {
+        size_t frames = (window - (s->decoded - s->base)) / (MINIMP3_MAX_SAMPLES_PER_FRAME / 2);
 
-        W_D_TYPE *slice = malloc(slice_samples * data_size);
+        if (!frames) {
+            // the last trim_end samples decoded at any point may turn out to be padding
+            uint64_t ready = MINIMP3_MAX(s->base, s->decoded > s->trim_end ? s->decoded - s->trim_end : 0);
 
-        if (!slice) {
-            fprintf(stderr, "Memory allocation failed for slice %d\n", i + 1);
+            w.samples = s->audio.samples;
+            w.first   = s->base * w.channels;
+            w.last    = ready * w.channels;
+            stream_window(&w, length, output);
+            mp3_session_drop(s, ready);
+            released = release_mapped(s->input, s->input_size, released, s->pos - s->input, 0);
             continue;
         }
 
-        memcpy(slice, (W_D_TYPE *)audio->samples + start_sample, slice_samples * data_size);
-        char output_filename[780];
-        snprintf(output_filename, sizeof(output_filename), "%s.wav", output_strs[i]);
+        if ((rc = mp3_session_decode(s, MINIMP3_MIN(frames, DECODE_CHUNK_FRAMES))) <= 0)
+            break;
+
+        trace_end_arg("decode", "decode chunk", chunk, "frames", rc);
+        stats->frames_decoded += rc;
+        chunk = trace_begin();
+    }
+
+    t = stats_stage(stats, STATS_DECODE, t);
+
+    // encoder padding, as mp3_session_finish() trims it
+    uint64_t total = s->decoded > s->trim_end ? s->decoded - s->trim_end : s->decoded;
+
+    w.samples = s->audio.samples;
+    w.first   = s->base * w.channels;
+    w.last    = total * w.channels;
+    stream_window(&w, length, output);
 
-        write_wave(output_filename, slice, slice_samples / audio->channels, audio->channels, audio->sample_rate);
+    for (int i = 0; i < length; i++)
+        slice_stream_finish(&slices[i]);
 
-        free(slice);
+    *audio = s->audio;
+    audio->samples     = NULL;
+    audio->num_samples = total * audio->channels;
+    mp3_session_close(s);
+
+    stats->slice_count = length;
+    stats_stage(stats, STATS_WRITE, t);
+
+    return rc < 0 ? -1 : 0;
+}
+
+// One slice of WAV input, converted a block at a time into a buffer of the task's own and
+// streamed out; input already in the output format goes out straight from the mapping. Each
+// block's input pages are let go once written.
+static void stream_wav_task(void *arg, size_t i) {
+    const stream_wav_job_t *job = arg;
+    const audio_data *audio     = job->audio;
+    const wav_info_t *info      = &job->in->info;
+    slice_stream_t *ss          = &job->slices[i];
+    size_t ch                   = audio->channels;
+    uint64_t first              = ss->start / ch;
+    uint64_t last               = MINIMP3_MIN(ss->end, audio->num_samples) / ch;
+
+    if (first < last) {
+        uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+        uintptr_t from = (uintptr_t)(job->in->buf + info->data_offset + first * info->block_align) & ~(page - 1);
+        uintptr_t to   = (uintptr_t)(job->in->buf + info->data_offset + last * info->block_align);
+
+        // read ahead through the slice, which the file's MADV_RANDOM would not
+        madvise((void *)from, to - from, MADV_SEQUENTIAL);
+    }
+
+    int in_place      = job->in->in_place;
+    W_D_TYPE *block   = in_place || first >= last ? NULL : pool_alloc(job->block_frames * ch * sizeof(W_D_TYPE));
+    int failed        = !in_place && first < last && !block;
+    uint64_t released = info->data_offset + first * info->block_align;
+
+    if (failed)
+        fprintf(stderr, "Memory allocation failed\n");
+
+    for (uint64_t f = first; !failed && f < last; f += job->block_frames) {
+        size_t frames = (size_t)MINIMP3_MIN(job->block_frames, last - f);
+
+        if (in_place) {
+            slice_stream_put(ss, (const W_D_TYPE *)audio->samples + f * ch, f * ch, (f + frames) * ch, (int)ch, audio->sample_rate);
+        } else {
+            double t = trace_begin();
+
+            if ((failed = wav_convert_frames(job->in, block, ch, f, frames) != 0))
+                break;
+            trace_end_arg("convert", "block", t, "frames", frames);
+
+            slice_stream_put(ss, block, f * ch, (f + frames) * ch, (int)ch, audio->sample_rate);
+        }
+
+        released = release_mapped(job->in->buf, job->in->size, released, info->data_offset + (f + frames) * info->block_align, 0);
+    }
+
+    if (first < last)
+        release_mapped(job->in->buf, job->in->size, released, info->data_offset + last * info->block_align, 1);
+
+    // a slice cut short fails like a write that failed
+    if (failed && ss->state == SLICE_STREAM_OPEN)
+        ss->out.failed = 1;
+    else if (failed)
+        ss->state = SLICE_STREAM_FAILED;
+
+    pool_free(block);
+    slice_stream_finish(ss);
+}
+
+// wav_input_load() and async_sliced_write_wave() within a budget: each slice is converted and
+// written block by block, by one task per slice. Returns the frames converted.
+uint64_t stream_wav_slices(const wav_input_t *in, const audio_data *audio, float lengths[][2], unsigned short length,
+                           const char *paths[], run_stats_t *stats) {
+    slice_stream_t slices[length];
+    uint64_t bytes[MAX_SLICES] = { 0 };
+    uint64_t frames = 0;
+    slice_plan_t plan;
+
+    stream_wav_job_t job = { in, audio, slices, 0 };
+    job.block_frames     = MINIMP3_MAX(256, WAV_CONVERT_BLOCK_BYTES / (in->info.block_align + audio->channels * sizeof(W_D_TYPE)));
+
+    for (int i = 0; i < length; i++) {
+        slice_stream_init(&slices[i], paths[i], lengths[i], audio->sample_rate, audio->channels, stats, &stats->slices[i]);
+        bytes[i] = wave_slice_bytes(audio, lengths[i], audio->num_samples);
+        frames  += bytes[i] ? (bytes[i] - sizeof(wav_header)) / sizeof(W_D_TYPE) / audio->channels : 0;
+    }
+
+    plan_slices(&plan, bytes, length, length ? paths[0] : ".");
+    run_slices(&plan, stream_wav_task, &job, length, NULL);
+
+    stats->slice_count = length;
+    return frames;
+}
+
+// --max-memory: whether resident bytes of audio fit in budget together with the copies the
+// writers make, one per slice write in flight (two per worker, and one on the decoder).
+int fits_budget(uint64_t budget, uint64_t resident, const audio_data *audio, float lengths[][2], unsigned short count) {
+    uint64_t largest = 0;
+
+    if (!budget)
+        return 1;
+
+    for (unsigned short i = 0; i < count; i++)
+        largest = MINIMP3_MAX(largest, wave_slice_bytes(audio, lengths[i], audio->num_samples));
+
+    return resident + largest * MINIMP3_MIN(count, 2 * sched_size() + 1) <= budget;
+}
+
+static void copy_mp3_task(void *arg, size_t slice) {
+    mp3_thread_args_t *args = (mp3_thread_args_t *)arg + slice;
+    stats_timer_t timer;
+    uint64_t samples = 0;
+
+    stats_slice_begin(args->run, args->stats, &timer);
+
+    int64_t bytes = write_mp3_slice(args->path, args->buf, args->index, args->lengths[0], args->lengths[1], &samples);
+
+    stats_slice_end(args->run, args->stats, &timer, bytes > 0 ? (uint64_t)bytes : 0, bytes > 0 ? samples : 0);
+}
+
+// Bytes of the input that a slice of the index copies, by its share of the stream.
+static uint64_t mp3_slice_bytes(const mp3_index_t *index, const float lengths[2]) {
+    if (!index->count || !index->total_samples || lengths[1] <= lengths[0])
+        return 0;
+
+    const mp3_frame_t *last = &index->frames[index->count - 1];
+    uint64_t audio_bytes    = last->offset + last->bytes - index->frames[0].offset;
+    double share            = (lengths[1] - lengths[0]) * index->sample_rate / index->total_samples;
+
+    return (uint64_t)(MINIMP3_MIN(share, 1.0) * audio_bytes);
+}
+
+void async_sliced_copy_mp3(const uint8_t *buf, const mp3_index_t *index, float lengths[][2], unsigned short length, const char *paths[], run_stats_t *stats) {
+
+    mp3_thread_args_t thread_args[length];
+    uint64_t bytes[MAX_SLICES] = { 0 };
+    slice_plan_t plan;
+
+    for (int i = 0; i < length; i++) {
+        thread_args[i].buf   = buf;
+        thread_args[i].index = index;
+        memcpy(thread_args[i].lengths, lengths[i], sizeof(float) * 2);
+        thread_args[i].path  = paths[i];
+        thread_args[i].run   = stats;
+        thread_args[i].stats = &stats->slices[i];
+
+        bytes[i] = mp3_slice_bytes(index, lengths[i]);
     }
+
+    plan_slices(&plan, bytes, length, length ? paths[0] : ".");
+    run_slices(&plan, copy_mp3_task, thread_args, length, NULL);
+
+    stats->slice_count = length;
 }
+
 int is_numeric(const char *str) {
     while (*str) {
         if (!isdigit(*str)) return 0;
@@ -314,12 +1464,15 @@ split_mode_t detect_split_mode(const char *outputs, const char *starts) {
     return CUSTOM_MODE;
 }
 
-void generate_auto_filename(char *output, const char *input_filename, int index) {
-    snprintf(output, MAX_FN_LENGTH, "%s_%d", input_filename, index + 1);
+const char *generate_auto_filename(arena_t *arena, const char *input_filename, int index) {
+    return arena_printf(arena, "%s_%d", input_filename, index + 1);
 }
 
-unsigned short get_lengths(char *output_fns, char *starts, char *ends,float lengths[][2], char output_strs[][MAX_FN_LENGTH],const char *input_filename, audio_data *audio) {
-    
+// Plans the slices: their times in lengths, and in names their output paths without the
+// extension, kept in arena until it is freed. Stops early, with the slices so far, if the
+// arena runs out of memory.
+unsigned short get_lengths(char *output_fns, char *starts, char *ends, float lengths[][2], const char *names[], arena_t *arena, const char *input_filename, audio_data *audio) {
+
     split_mode_t mode = detect_split_mode(output_fns, starts);
     unsigned short count = 0;
 
@@ -335,7 +1488,8 @@ unsigned short get_lengths(char *output_fns, char *starts, char *ends,float leng
                 if (lengths[count][1] > total_duration) {
                     lengths[count][1] = total_duration;
                 }
-                generate_auto_filename(output_strs[count], ends, count);
+                if (!(names[count] = generate_auto_filename(arena, ends, count)))
+                    break;
                 current_time += segment_length;
                 count++;
             }
@@ -351,7 +1505,8 @@ unsigned short get_lengths(char *output_fns, char *starts, char *ends,float leng
             while (start_token && end_token && count < MAX_SLICES) {
                 lengths[count][0] = atof(start_token);
                 lengths[count][1] = atof(end_token);
-                generate_auto_filename(output_strs[count], input_filename, count);
+                if (!(names[count] = generate_auto_filename(arena, input_filename, count)))
+                    break;
                 count++;
                 start_token = strtok_r(NULL, DELIMITER, &rest_starts);
                 end_token = strtok_r(NULL, DELIMITER, &rest_ends);
@@ -370,8 +1525,9 @@ unsigned short get_lengths(char *output_fns, char *starts, char *ends,float leng
             while (start_token && end_token && output_fn_token && count < MAX_SLICES) {
                 lengths[count][0] = atof(start_token);
                 lengths[count][1] = atof(end_token);
-                strncpy(output_strs[count], output_fn_token, MAX_FN_LENGTH - 1);
-                output_strs[count][MAX_FN_LENGTH - 1] = '\0';
+                // the token points into output_fns, which the caller may free before the arena
+                if (!(names[count] = arena_strdup(arena, output_fn_token)))
+                    break;
                 count++;
                 start_token = strtok_r(NULL, DELIMITER, &rest_starts);
                 end_token = strtok_r(NULL, DELIMITER, &rest_ends);
@@ -384,28 +1540,166 @@ unsigned short get_lengths(char *output_fns, char *starts, char *ends,float leng
     return count;
 }
 
+// The output file of each named slice, in the same arena. Returns -1 without memory.
+int slice_paths(arena_t *arena, const char *names[], unsigned short count, const char *ext, const char *paths[]) {
+    for (int i = 0; i < count; i++) {
+        if (!(paths[i] = arena_printf(arena, "%s.%s", names[i], ext))) {
+            fprintf(stderr, "Memory allocation failed for output names\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+
+// A byte count with an optional K, M or G suffix (powers of 1024). Returns 0, or -1 if str is
+// not one.
+int parse_size(const char *str, uint64_t *size) {
+    char *end;
+    unsigned long long n = strtoull(str, &end, 10);
+    int shift = 0;
+
+    if (end == str || *str == '-')
+        return -1;
+
+    switch (toupper((unsigned char)*end)) {
+        case 'K': shift = 10; end++; break;
+        case 'M': shift = 20; end++; break;
+        case 'G': shift = 30; end++; break;
+    }
+
+    if (*end || n > UINT64_MAX >> shift)
+        return -1;
+
+    *size = (uint64_t)n << shift;
+    return 0;
+}
+
+int parse_options(int argc, char *argv[], options_t *opts, char *positional[], int max_positional) {
+    int count = 0;
+
+    opts->ch_mode = MP3D_CH_NATIVE;
+    opts->output  = OUTPUT_WAV;
+    opts->gapless = 1;
+    opts->quiet   = 0;
+    opts->stats_json = 0;
+    opts->counters   = 0;
+    opts->trace_file = NULL;
+    opts->probe      = 0;
+    opts->pin        = 0;
+    opts->huge_pages = 0;
+    opts->max_memory = 0;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+
+        if (strncmp(arg, "--", 2) != 0) {
+            if (count == max_positional)
+                return -1;
+            positional[count++] = argv[i];
+        } else if (strcmp(arg, "--mono") == 0) {
+            opts->ch_mode = MP3D_CH_MONO;
+        } else if (strcmp(arg, "--channel=left") == 0) {
+            opts->ch_mode = MP3D_CH_LEFT;
+        } else if (strcmp(arg, "--channel=right") == 0) {
+            opts->ch_mode = MP3D_CH_RIGHT;
+        } else if (strcmp(arg, "--output=wav") == 0) {
+            opts->output = OUTPUT_WAV;
+        } else if (strcmp(arg, "--output=mp3") == 0) {
+            opts->output = OUTPUT_MP3;
+        } else if (strcmp(arg, "--no-gapless") == 0) {
+            opts->gapless = 0;
+        } else if (strcmp(arg, "--quiet") == 0) {
+            opts->quiet = 1;
+        } else if (strcmp(arg, "--stats=json") == 0) {
+            opts->stats_json = 1;
+        } else if (strncmp(arg, "--trace=", 8) == 0 && arg[8]) {
+            opts->trace_file = arg + 8;
+        } else if (strcmp(arg, "--probe") == 0) {
+            opts->probe = 1;
+        } else if (strcmp(arg, "--pin") == 0) {
+            opts->pin = 1;
+        } else if (strcmp(arg, "--huge-pages") == 0) {
+            opts->huge_pages = 1;
+        } else if (strncmp(arg, "--max-memory=", 13) == 0) {
+            if (parse_size(arg + 13, &opts->max_memory) != 0) {
+                fprintf(stderr, "Invalid size: %s\n", arg);
+                return -1;
+            }
+        } else if (strcmp(arg, "--counters") == 0) {
+            opts->stats_json = 1;
+            opts->counters   = 1;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg);
+            return -1;
+        }
+    }
 
+    return count;
+}
 
+// benchmark/bench.c includes this file for its stages and brings its own main
+#ifndef CONV_NO_MAIN
 int main(int argc, char *argv[]) {
-    if (argc != 5) {
-        fprintf(stderr, "Usage: %s <input_file> <outputs> <starts> <ends>\n", argv[0]);
+    options_t opts;
+    char *args[argc];
+    int count = parse_options(argc, argv, &opts, args, argc);
+
+    sched_set_pinning(opts.pin);
+    sched_set_timing(opts.stats_json);
+    pool_set_huge_pages(opts.huge_pages);
+
+    if (opts.probe && count > 0) {
+        int failed = probe_paths(args, count, stdout);
+        sched_shutdown();
+        return failed == 0 ? 0 : 1;
+    }
+
+    if (count != 4) {
+        fprintf(stderr, "Usage: %s [options] <input_file> <outputs> <starts> <ends>\n", argv[0]);
+        fprintf(stderr, "       %s --probe <files or directories>...\n", argv[0]);
         fprintf(stderr, "Modes:\n");
         fprintf(stderr, "1. Custom names: <names> <start_times> <end_times>\n");
         fprintf(stderr, "2. Auto names: AUTO <start_times> <end_times>\n");
         fprintf(stderr, "3. Fixed length: AUTO <segment_length> \"\"\n");
+        fprintf(stderr, "Options:\n");
+        fprintf(stderr, "  --mono            Downmix to one channel (MP3: mixed before synthesis)\n");
+        fprintf(stderr, "  --channel=left    Keep only the left channel\n");
+        fprintf(stderr, "  --channel=right   Keep only the right channel\n");
+        fprintf(stderr, "  --output=mp3      Cut MP3 input by copying frames (no decode)\n");
+        fprintf(stderr, "  --no-gapless      Keep MP3 encoder delay/padding on the timeline\n");
+        fprintf(stderr, "  --quiet           No progress lines on stdout (errors still go to stderr)\n");
+        fprintf(stderr, "  --stats=json      Print stage timings and counters as JSON on stdout\n");
+        fprintf(stderr, "  --counters        Add per-stage and per-thread hardware counters (implies --stats=json)\n");
+        fprintf(stderr, "  --trace=<file>    Write a Chrome trace (chrome://tracing, Perfetto) of all threads\n");
+        fprintf(stderr, "  --probe           Print format, duration and tags of each file as JSON lines, from headers only\n");
+        fprintf(stderr, "  --pin             Pin workers to CPUs and keep buffers on the NUMA node of the workers using them\n");
+        fprintf(stderr, "  --huge-pages      Ask for transparent huge pages for audio buffers of 2 MiB and more\n");
+        fprintf(stderr, "  --max-memory=<n>  Stream slices to disk instead of decoding whole inputs larger than n bytes (K, M, G)\n");
         return 1;
     }
 
-    struct timespec start, end;
-    clock_gettime(CLOCK_MONOTONIC, &start);
+    log_set_quiet(opts.quiet || opts.stats_json);
+
+    if (opts.trace_file) {
+        trace_start();
+        trace_thread_name("main");
+    }
+
+    static run_stats_t stats;
+    stats_init(&stats, opts.counters);
+    double t = stats.start;
     
     float lengths[MAX_SLICES][2];
-    char out_fns[MAX_SLICES][MAX_FN_LENGTH];
+    const char *out_fns[MAX_SLICES];
+    const char *out_paths[MAX_SLICES];
+    arena_t plan_arena = { 0 };
 
-    char *input_filename = argv[1];
-    char *output_fns = strdup(argv[2]);
-    char *starts = strdup(argv[3]);
-    char *ends = strdup(argv[4]);
+    char *input_filename = args[0];
+    char *output_fns = mem_strdup(args[1]);
+    char *starts = mem_strdup(args[2]);
+    char *ends = mem_strdup(args[3]);
 
     if (!starts || !ends || !output_fns) {
         fprintf(stderr, "Memory allocation failed\n");
@@ -413,35 +1707,125 @@ int main(int argc, char *argv[]) {
     }
 
     audio_type type = detect_audio_type(input_filename);
+    log_info("%s auto detected to be %s\n", input_filename, get_mime_type(type));
     audio_data audio = {0};
+    wav_input_t wav  = {0};
+    unsigned int length = 0;
 
-    switch (type) {
-        case 1:
-            audio = read_mp3(input_filename);
-            break;
-        case 2:
-            audio = read_wav(input_filename);
-            break;
-        default:
-            fprintf(stderr, "Unsupported audio format\n");
+    struct stat st;
+    if (stat(input_filename, &st) == 0)
+        stats.bytes_in = st.st_size;
+
+    t = stats_stage(&stats, STATS_DETECT, t);
+
+    if (opts.output == OUTPUT_MP3) {
+        if (type != AUDIO_MPEG || opts.ch_mode != MP3D_CH_NATIVE) {
+            fprintf(stderr, "--output=mp3 needs MP3 input and no channel options\n");
             return 1;
+        }
+
+        uint64_t size = 0;
+        const uint8_t *buf = map_file(input_filename, &size);
+        mp3_index_t index;
+
+        if (!buf || build_mp3_index(buf, size, &index) != 0) {
+            fprintf(stderr, "Failed to index input file: %s\n", input_filename);
+            unmap_file(buf, size);
+            return 1;
+        }
+
+        if (!opts.gapless)
+            index.trim_start = index.trim_end = 0;
+
+        audio.sample_rate = index.sample_rate;
+        audio.channels    = index.channels;
+        audio.num_samples = mp3_index_samples(&index) * index.channels;
+        t = stats_stage(&stats, STATS_READ, t);
+
+        length = get_lengths(output_fns, starts, ends, lengths, out_fns, &plan_arena, input_filename, &audio);
+        if (slice_paths(&plan_arena, out_fns, length, "mp3", out_paths) != 0)
+            length = 0;
+        t = stats_stage(&stats, STATS_PLAN, t);
+
+        async_sliced_copy_mp3(buf, &index, lengths, length, out_paths, &stats);
+        stats_stage(&stats, STATS_WRITE, t);
+
+        free_mp3_index(&index);
+        unmap_file(buf, size);
+    } else {
+        mp3_session_t session;
+
+        switch (type) {
+            case 1:
+                if (mp3_session_open(&session, input_filename, opts.ch_mode, opts.gapless) != 0)
+                    return 1;
+                stats_stage(&stats, STATS_READ, t);
+
+                // planned from the headers, so slices can be written while the stream decodes
+                audio.sample_rate = session.tag.sample_rate;
+                audio.channels    = opts.ch_mode == MP3D_CH_NATIVE ? session.tag.channels : 1;
+                audio.num_samples = session.expected * audio.channels;
+                break;
+            case 2:
+                if (wav_input_open(&wav, &audio, input_filename, opts.ch_mode) != 0)
+                    return 1;
+                stats_stage(&stats, STATS_READ, t);
+                break;
+            default:
+                fprintf(stderr, "Unsupported audio format\n");
+                return 1;
+        }
+
+        stats.samples_decoded = audio.num_samples;
+        t = stats_now();
+
+        length = get_lengths(output_fns, starts, ends, lengths, out_fns, &plan_arena, input_filename, &audio);
+        if (slice_paths(&plan_arena, out_fns, length, "wav", out_paths) != 0)
+            length = 0;
+        t = stats_stage(&stats, STATS_PLAN, t);
+
+        if (type == AUDIO_MPEG && !fits_budget(opts.max_memory, session.capacity * sizeof(W_D_TYPE), &audio, lengths, length)) {
+            log_info("Decoded audio exceeds --max-memory, streaming slices through a window\n");
+            stream_and_write_wave(&session, &audio, lengths, length, out_paths, &stats, opts.max_memory / 2);
+            stats.samples_decoded = audio.num_samples;
+        } else if (type == AUDIO_MPEG) {
+            decode_and_write_wave(&session, &audio, lengths, length, out_paths, &stats);
+            stats.samples_decoded = audio.num_samples;
+        } else if (wav.buf && !fits_budget(opts.max_memory, wav_input_load_bytes(&wav, &audio, lengths, length), &audio, lengths, length)) {
+            log_info("Converted audio exceeds --max-memory, streaming slices block by block\n");
+            stats.samples_decoded = stream_wav_slices(&wav, &audio, lengths, length, out_paths, &stats) * audio.channels;
+            stats_stage(&stats, STATS_WRITE, t);
+        } else {
+            // WAV samples are read only now, and only where the slices are
+            stats.samples_decoded = wav_input_load(&wav, &audio, lengths, length) * audio.channels;
+            t = stats_stage(&stats, STATS_DECODE, t);
+
+            async_sliced_write_wave(&audio, lengths, length, out_paths, &stats);
+            stats_stage(&stats, STATS_WRITE, t);
+        }
     }
 
-    unsigned int length = get_lengths(output_fns, starts, ends, lengths, out_fns, input_filename, &audio);
-    
-    async_sliced_write_wave(&audio, lengths, length, out_fns);
 
-    // sliced_write_wave(&audio, lengths, length, out_fns);
+    log_info("\nTime taken: %ld microseconds\n", (long)((stats_now() - stats.start) * 1e6));
 
+    // the workers' trace buffers and counters are only read once they are joined
+    sched_shutdown();
 
-    clock_gettime(CLOCK_MONOTONIC, &end);
-    long elapsed_time = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
-    printf("\nTime taken: %ld microseconds\n", elapsed_time);
+    if (opts.stats_json)
+        stats_print_json(stdout, &stats, input_filename, get_mime_type(type),
+                         opts.output == OUTPUT_MP3 ? "mp3" : "wav", lengths, out_fns);
+    stats_close(&stats);
 
-    free(starts);
-    free(ends);
-    free(output_fns);
-    free(audio.samples);
+    if (opts.trace_file)
+        trace_write(opts.trace_file);
+
+    mem_free(starts);
+    mem_free(ends);
+    mem_free(output_fns);
+    free_audio_data(&audio);
+    wav_input_close(&wav);
+    arena_free(&plan_arena);
 
     return 0;
 }
+#endif
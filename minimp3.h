@@ -10,6 +10,12 @@
 
 #define MINIMP3_MAX_SAMPLES_PER_FRAME (1152*2)
 
+/* output channel selection for mp3dec_decode_frame_ch() */
+#define MP3D_CH_NATIVE  0   /* stream layout, as mp3dec_decode_frame() */
+#define MP3D_CH_MONO    1   /* (L + R)/2, synthesised once */
+#define MP3D_CH_LEFT    2   /* left only, right skipped where the stream allows */
+#define MP3D_CH_RIGHT   3   /* right only, left skipped where the stream allows */
+
 typedef struct
 {
     int frame_bytes, frame_offset, channels, hz, layer, bitrate_kbps;
@@ -34,6 +40,8 @@ typedef float mp3d_sample_t;
 void mp3dec_f32_to_s16(const float *in, int16_t *out, int num_samples);
 #endif /* MINIMP3_FLOAT_OUTPUT */
 int mp3dec_decode_frame(mp3dec_t *dec, const uint8_t *mp3, int mp3_bytes, mp3d_sample_t *pcm, mp3dec_frame_info_t *info);
+/* same as mp3dec_decode_frame(), info->channels reports the output channel count */
+int mp3dec_decode_frame_ch(mp3dec_t *dec, const uint8_t *mp3, int mp3_bytes, mp3d_sample_t *pcm, mp3dec_frame_info_t *info, int ch_mode);
 
 #ifdef __cplusplus
 }
@@ -46,6 +54,11 @@ int mp3dec_decode_frame(mp3dec_t *dec, const uint8_t *mp3, int mp3_bytes, mp3d_s
 #include <stdlib.h>
 #include <string.h>
 
+/* benchmark/kernels.c defines this to record the inputs of the hot kernels */
+#ifndef MINIMP3_CAPTURE
+#define MINIMP3_CAPTURE(kernel, ...)
+#endif /* MINIMP3_CAPTURE */
+
 #define MAX_FREE_FORMAT_FRAME_SIZE  2304    /* more than ISO spec's */
 #ifndef MAX_FRAME_SYNC_MATCHES
 #define MAX_FRAME_SYNC_MATCHES      10
@@ -1235,26 +1248,43 @@ static int L3_restore_reservoir(mp3dec_t *h, bs_t *bs, mp3dec_scratch_t *s, int
     return h->reserv >= main_data_begin;
 }
 
-static void L3_decode(mp3dec_t *h, mp3dec_scratch_t *s, L3_gr_info_t *gr_info, int nch)
+static void L3_decode(mp3dec_t *h, mp3dec_scratch_t *s, L3_gr_info_t *gr_info, int nch, int ch_mode)
 {
-    int ch;
+    int ch, ch_first = 0, ch_last = nch;
+
+    /* without joint stereo the channels are independent, so the unused one is only skipped over */
+    if (nch == 2 && ch_mode >= MP3D_CH_LEFT && !HDR_TEST_I_STEREO(h->header) && !HDR_IS_MS_STEREO(h->header))
+    {
+        ch_first = ch_mode - MP3D_CH_LEFT;
+        ch_last = ch_first + 1;
+        memset(h->mdct_overlap[1 - ch_first], 0, sizeof(h->mdct_overlap[0]));
+    }
 
     for (ch = 0; ch < nch; ch++)
     {
         int layer3gr_limit = s->bs.pos + gr_info[ch].part_23_length;
+        if (ch < ch_first || ch >= ch_last)
+        {
+            s->bs.pos = layer3gr_limit;
+            continue;
+        }
         L3_decode_scalefactors(h->header, s->ist_pos[ch], &s->bs, gr_info + ch, s->scf, ch);
+        MINIMP3_CAPTURE(L3_huffman, &s->bs, gr_info + ch, s->scf, layer3gr_limit);
         L3_huffman(s->grbuf[ch], &s->bs, gr_info + ch, s->scf, layer3gr_limit);
     }
 
-    if (HDR_TEST_I_STEREO(h->header))
-    {
-        L3_intensity_stereo(s->grbuf[0], s->ist_pos[1], gr_info, h->header);
-    } else if (HDR_IS_MS_STEREO(h->header))
+    if (ch_last - ch_first == nch)
     {
-        L3_midside_stereo(s->grbuf[0], 576);
+        if (HDR_TEST_I_STEREO(h->header))
+        {
+            L3_intensity_stereo(s->grbuf[0], s->ist_pos[1], gr_info, h->header);
+        } else if (HDR_IS_MS_STEREO(h->header))
+        {
+            L3_midside_stereo(s->grbuf[0], 576);
+        }
     }
 
-    for (ch = 0; ch < nch; ch++, gr_info++)
+    for (ch = ch_first, gr_info += ch_first; ch < ch_last; ch++, gr_info++)
     {
         int aa_bands = 31;
         int n_long_bands = (gr_info->mixed_block_flag ? 2 : 0) << (int)(HDR_GET_MY_SAMPLE_RATE(h->header) == 2);
@@ -1265,7 +1295,9 @@ static void L3_decode(mp3dec_t *h, mp3dec_scratch_t *s, L3_gr_info_t *gr_info, i
             L3_reorder(s->grbuf[ch] + n_long_bands*18, s->syn[0], gr_info->sfbtab + gr_info->n_long_sfb);
         }
 
+        MINIMP3_CAPTURE(L3_antialias, s->grbuf[ch], aa_bands);
         L3_antialias(s->grbuf[ch], aa_bands);
+        MINIMP3_CAPTURE(L3_imdct_gr, s->grbuf[ch], h->mdct_overlap[ch], gr_info->block_type, n_long_bands);
         L3_imdct_gr(s->grbuf[ch], h->mdct_overlap[ch], gr_info->block_type, n_long_bands);
         L3_change_sign(s->grbuf[ch]);
     }
@@ -1629,6 +1661,7 @@ static void mp3d_synth(float *xl, mp3d_sample_t *dstl, int nch, float *lins)
 static void mp3d_synth_granule(float *qmf_state, float *grbuf, int nbands, int nch, mp3d_sample_t *pcm, float *lins)
 {
     int i;
+    MINIMP3_CAPTURE(mp3d_synth_granule, qmf_state, grbuf, nbands, nch);
     for (i = 0; i < nch; i++)
     {
         mp3d_DCT_II(grbuf + 576*i, nbands);
@@ -1654,6 +1687,36 @@ static void mp3d_synth_granule(float *qmf_state, float *grbuf, int nbands, int n
     }
 }
 
+/* synthesis is linear, so the mono mix is formed on subband samples and the QMF bank runs once */
+static float *mp3d_select_channels(float *grbuf, int nch, int ch_mode)
+{
+    int i = 0;
+    float *right = grbuf + 576;
+    if (nch == 1 || ch_mode == MP3D_CH_LEFT)
+    {
+        return grbuf;
+    }
+    if (ch_mode == MP3D_CH_RIGHT)
+    {
+        return right;
+    }
+#if HAVE_SIMD
+    if (have_simd())
+    {
+        static const f4 g_half = { 0.5f, 0.5f, 0.5f, 0.5f };
+        for (; i < 576; i += 4)
+        {
+            VSTORE(grbuf + i, VMUL(VADD(VLD(grbuf + i), VLD(right + i)), g_half));
+        }
+    }
+#endif /* HAVE_SIMD */
+    for (; i < 576; i++)
+    {
+        grbuf[i] = (grbuf[i] + right[i])*0.5f;
+    }
+    return grbuf;
+}
+
 static int mp3d_match_frame(const uint8_t *hdr, int mp3_bytes, int frame_bytes)
 {
     int i, nmatch;
@@ -1668,11 +1731,70 @@ static int mp3d_match_frame(const uint8_t *hdr, int mp3_bytes, int frame_bytes)
     return 1;
 }
 
+/* Offset of the first byte in mp3[0..n) that can start a header (0xFF, then three set sync
+   bits), or n; mp3[n] must be readable. Junk, tags and damaged regions rarely have such a
+   pair, so the vector paths test 32 or 16 positions per step and hdr_valid() only runs on hits. */
+static int mp3d_find_sync(const uint8_t *mp3, int n)
+{
+    int i = 0;
+#if HAVE_SSE
+#if defined(__AVX2__)
+    {
+        const __m256i ff = _mm256_set1_epi8((char)0xFF), sync = _mm256_set1_epi8((char)0xE0);
+        for (; i + 32 <= n; i += 32)
+        {
+            __m256i b0 = _mm256_loadu_si256((const __m256i *)(mp3 + i));
+            __m256i b1 = _mm256_loadu_si256((const __m256i *)(mp3 + i + 1));
+            __m256i hit = _mm256_and_si256(_mm256_cmpeq_epi8(b0, ff), _mm256_cmpeq_epi8(_mm256_and_si256(b1, sync), sync));
+            if (_mm256_movemask_epi8(hit))
+                break;
+        }
+    }
+#endif /* defined(__AVX2__) */
+    if (have_simd())
+    {
+        const __m128i ff = _mm_set1_epi8((char)0xFF), sync = _mm_set1_epi8((char)0xE0);
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i b0 = _mm_loadu_si128((const __m128i *)(mp3 + i));
+            __m128i b1 = _mm_loadu_si128((const __m128i *)(mp3 + i + 1));
+            __m128i hit = _mm_and_si128(_mm_cmpeq_epi8(b0, ff), _mm_cmpeq_epi8(_mm_and_si128(b1, sync), sync));
+            if (_mm_movemask_epi8(hit))
+                break;
+        }
+    }
+#elif HAVE_SIMD && defined(__aarch64__)
+    {
+        const uint8x16_t sync = vdupq_n_u8(0xE0);
+        for (; i + 16 <= n; i += 16)
+        {
+            uint8x16_t b0 = vld1q_u8(mp3 + i);
+            uint8x16_t b1 = vld1q_u8(mp3 + i + 1);
+            uint8x16_t hit = vandq_u8(vceqq_u8(b0, vdupq_n_u8(0xFF)), vceqq_u8(vandq_u8(b1, sync), sync));
+            if (vmaxvq_u8(hit))
+                break;
+        }
+    }
+#endif /* HAVE_SSE */
+    /* the block with the hit, or the tail */
+    for (; i < n; i++)
+    {
+        if (mp3[i] == 0xFF && (mp3[i + 1] & 0xE0) == 0xE0)
+            break;
+    }
+    return i;
+}
+
 static int mp3d_find_frame(const uint8_t *mp3, int mp3_bytes, int *free_format_bytes, int *ptr_frame_bytes)
 {
     int i, k;
     for (i = 0; i < mp3_bytes - HDR_SIZE; i++, mp3++)
     {
+        int skip = mp3d_find_sync(mp3, mp3_bytes - HDR_SIZE - i);
+        i += skip;
+        mp3 += skip;
+        if (i >= mp3_bytes - HDR_SIZE)
+            break;
         if (hdr_valid(mp3))
         {
             int frame_bytes = hdr_frame_bytes(mp3, *free_format_bytes);
@@ -1712,7 +1834,12 @@ void mp3dec_init(mp3dec_t *dec)
 
 int mp3dec_decode_frame(mp3dec_t *dec, const uint8_t *mp3, int mp3_bytes, mp3d_sample_t *pcm, mp3dec_frame_info_t *info)
 {
-    int i = 0, igr, frame_size = 0, success = 1;
+    return mp3dec_decode_frame_ch(dec, mp3, mp3_bytes, pcm, info, MP3D_CH_NATIVE);
+}
+
+int mp3dec_decode_frame_ch(mp3dec_t *dec, const uint8_t *mp3, int mp3_bytes, mp3d_sample_t *pcm, mp3dec_frame_info_t *info, int ch_mode)
+{
+    int i = 0, igr, nch, out_ch, frame_size = 0, success = 1;
     const uint8_t *hdr;
     bs_t bs_frame[1];
     mp3dec_scratch_t scratch;
@@ -1744,6 +1871,9 @@ int mp3dec_decode_frame(mp3dec_t *dec, const uint8_t *mp3, int mp3_bytes, mp3d_s
     info->hz = hdr_sample_rate_hz(hdr);
     info->layer = 4 - HDR_GET_LAYER(hdr);
     info->bitrate_kbps = hdr_bitrate_kbps(hdr);
+    nch = info->channels;
+    out_ch = ch_mode == MP3D_CH_NATIVE ? nch : 1;
+    info->channels = out_ch;
 
     if (!pcm)
     {
@@ -1767,11 +1897,11 @@ int mp3dec_decode_frame(mp3dec_t *dec, const uint8_t *mp3, int mp3_bytes, mp3d_s
         success = L3_restore_reservoir(dec, bs_frame, &scratch, main_data_begin);
         if (success)
         {
-            for (igr = 0; igr < (HDR_TEST_MPEG1(hdr) ? 2 : 1); igr++, pcm += 576*info->channels)
+            for (igr = 0; igr < (HDR_TEST_MPEG1(hdr) ? 2 : 1); igr++, pcm += 576*out_ch)
             {
                 memset(scratch.grbuf[0], 0, 576*2*sizeof(float));
-                L3_decode(dec, &scratch, scratch.gr_info + igr*info->channels, info->channels);
-                mp3d_synth_granule(dec->qmf_state, scratch.grbuf[0], 18, info->channels, pcm, scratch.syn[0]);
+                L3_decode(dec, &scratch, scratch.gr_info + igr*nch, nch, ch_mode);
+                mp3d_synth_granule(dec->qmf_state, out_ch == nch ? scratch.grbuf[0] : mp3d_select_channels(scratch.grbuf[0], nch, ch_mode), 18, out_ch, pcm, scratch.syn[0]);
             }
         }
         L3_save_reservoir(dec, &scratch);
@@ -1790,9 +1920,9 @@ int mp3dec_decode_frame(mp3dec_t *dec, const uint8_t *mp3, int mp3_bytes, mp3d_s
             {
                 i = 0;
                 L12_apply_scf_384(sci, sci->scf + igr, scratch.grbuf[0]);
-                mp3d_synth_granule(dec->qmf_state, scratch.grbuf[0], 12, info->channels, pcm, scratch.syn[0]);
+                mp3d_synth_granule(dec->qmf_state, out_ch == nch ? scratch.grbuf[0] : mp3d_select_channels(scratch.grbuf[0], nch, ch_mode), 12, out_ch, pcm, scratch.syn[0]);
                 memset(scratch.grbuf[0], 0, 576*2*sizeof(float));
-                pcm += 384*info->channels;
+                pcm += 384*out_ch;
             }
             if (bs_frame->pos > bs_frame->limit)
             {
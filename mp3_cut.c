@@ -0,0 +1,457 @@
+// Frame-accurate MP3 slicing by copying frames, no decode.
+// Needs the minimp3 implementation (hdr_* helpers, mp3d_find_frame) and vbr_tag.c in the same unit.
+
+typedef struct {
+    uint64_t offset;            // byte offset of the frame header in the input
+    uint64_t sample;            // first decoded sample (per channel) of the frame
+    uint64_t payload_pos;       // main data bytes carried by all earlier frames
+    uint32_t bytes;             // frame length including padding
+    uint16_t main_data_begin;   // bit reservoir back-reference in bytes
+    uint16_t samples;           // samples per channel
+} mp3_frame_t;
+
+typedef struct {
+    mp3_frame_t *frames;
+    size_t count;
+    uint64_t total_samples;     // per channel, as decoded
+    uint64_t trim_start;        // gapless trim: decoded samples before the first real one
+    uint64_t trim_end;          // and after the last one
+    int sample_rate;
+    int channels;
+    int first_is_tag;           // frame 0 is a Xing/Info/VBRI header, not audio
+    vbr_tag_t tag;
+} mp3_index_t;
+
+
+static int mp3_main_data_begin(const uint8_t *h) {
+    const uint8_t *si = h + HDR_SIZE + (HDR_IS_CRC(h) ? 2 : 0);
+    if (HDR_TEST_MPEG1(h))
+        return (si[0] << 1) | (si[1] >> 7);
+    return si[0];
+}
+
+void free_mp3_index(mp3_index_t *index) {
+    mem_free(index->frames);
+    memset(index, 0, sizeof(*index));
+}
+
+// Steps to the frame at *pos, resyncing past junk if needed. prev is the previous frame's
+// header or NULL. Returns the frame length with *pos at its header, or 0 at the end of buf.
+int mp3_walk_frame(const uint8_t *buf, uint64_t size, uint64_t *pos, const uint8_t *prev, int *free_format_bytes) {
+    if (*pos + HDR_SIZE >= size)
+        return 0;
+
+    const uint8_t *h = buf + *pos;
+    uint64_t remaining = size - *pos;
+    int frame_bytes = 0;
+
+    // same fast path as mp3dec_decode_frame: trust the header chain, resync only when it breaks
+    if (prev && hdr_compare(prev, h)) {
+        frame_bytes = hdr_frame_bytes(h, *free_format_bytes) + hdr_padding(h);
+        if ((uint64_t)frame_bytes != remaining && ((uint64_t)frame_bytes + HDR_SIZE > remaining || !hdr_compare(h, h + frame_bytes)))
+            frame_bytes = 0;
+    }
+
+    if (!frame_bytes) {
+        int window = (int)MINIMP3_MIN(remaining, (uint64_t)INT32_MAX);
+        int skip   = mp3d_find_frame(h, window, free_format_bytes, &frame_bytes);
+
+        if (!frame_bytes || (uint64_t)skip + frame_bytes > remaining)
+            return 0;
+
+        *pos += skip;
+    }
+
+    return frame_bytes;
+}
+
+// Samples per channel of the frames from pos up to end, from their headers alone. *vbr is
+// set if the bitrate changes; it may be NULL.
+uint64_t mp3_count_samples(const uint8_t *buf, uint64_t pos, uint64_t end, int *vbr) {
+    const uint8_t *prev = NULL;
+    int free_format_bytes = 0, frame_bytes, bitrate = -1;
+    uint64_t samples = 0;
+
+    while ((frame_bytes = mp3_walk_frame(buf, end, &pos, prev, &free_format_bytes)) > 0) {
+        const uint8_t *h = buf + pos;
+
+        if (vbr && bitrate >= 0 && HDR_GET_BITRATE(h) != bitrate)
+            *vbr = 1;
+        bitrate = HDR_GET_BITRATE(h);
+
+        samples += hdr_frame_samples(h);
+        prev = h;
+        pos += frame_bytes;
+    }
+
+    return samples;
+}
+
+int build_mp3_index(const uint8_t *buf, uint64_t size, mp3_index_t *index) {
+    memset(index, 0, sizeof(*index));
+
+    size_t capacity = size / 96 + 16;
+    index->frames   = mem_alloc(capacity * sizeof(mp3_frame_t));
+
+    if (!index->frames) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return -1;
+    }
+
+    const uint8_t *prev = NULL;
+    int free_format_bytes = 0;
+    uint64_t pos, sample = 0, payload_pos = 0;
+
+    // offsets stay relative to buf; only the scan range excludes the tags
+    mp3_audio_range(buf, size, &pos, &size);
+
+    int frame_bytes;
+
+    while ((frame_bytes = mp3_walk_frame(buf, size, &pos, prev, &free_format_bytes)) > 0) {
+        const uint8_t *h = buf + pos;
+
+        if (index->count == capacity) {
+            capacity *= 2;
+            mp3_frame_t *grown = mem_realloc(index->frames, capacity * sizeof(mp3_frame_t));
+            if (!grown) {
+                fprintf(stderr, "Memory allocation failed\n");
+                free_mp3_index(index);
+                return -1;
+            }
+            index->frames = grown;
+        }
+
+        mp3_frame_t *f = &index->frames[index->count];
+        int header_bytes = HDR_SIZE + (HDR_IS_CRC(h) ? 2 : 0) + mp3_side_info_size(h);
+
+        f->offset          = pos;
+        f->sample          = sample;
+        f->payload_pos     = payload_pos;
+        f->bytes           = frame_bytes;
+        f->main_data_begin = mp3_main_data_begin(h);
+        f->samples         = hdr_frame_samples(h);
+
+        if (index->count == 0) {
+            index->sample_rate  = hdr_sample_rate_hz(h);
+            index->channels     = HDR_IS_MONO(h) ? 1 : 2;
+            index->first_is_tag = parse_vbr_tag(h, frame_bytes, &index->tag);
+            vbr_tag_trim(&index->tag, &index->trim_start, &index->trim_end);
+        }
+
+        // a leading VBR tag frame is neither audio nor part of the bit reservoir stream
+        if (index->count > 0 || !index->first_is_tag)
+            payload_pos += frame_bytes > header_bytes ? frame_bytes - header_bytes : 0;
+        else
+            f->samples = 0;
+
+        sample += f->samples;
+        prev    = h;
+        pos    += frame_bytes;
+        index->count++;
+    }
+
+    index->total_samples = sample;
+
+    if (!index->count) {
+        fprintf(stderr, "No MPEG audio frames found\n");
+        free_mp3_index(index);
+        return -1;
+    }
+
+    // a truncated stream may be shorter than its tag promised
+    if (index->trim_start + index->trim_end >= index->total_samples)
+        index->trim_start = index->trim_end = 0;
+
+    return 0;
+}
+
+// Playable samples per channel once the gapless trim is applied.
+uint64_t mp3_index_samples(const mp3_index_t *index) {
+    return index->total_samples - index->trim_start - index->trim_end;
+}
+
+static size_t mp3_frame_at(const mp3_index_t *index, uint64_t sample) {
+    size_t lo = 0, hi = index->count - 1;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo + 1) / 2;
+        if (index->frames[mid].sample <= sample)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    return lo;
+}
+
+// CRC of protected frames: poly 0x8005 over header bytes 2-3 and the side info
+static uint16_t mp3_frame_crc(const uint8_t *h) {
+    uint16_t crc = 0xFFFF;
+    int side = mp3_side_info_size(h);
+
+    for (int i = 2; i < HDR_SIZE + 2 + side; i++) {
+        if (i == HDR_SIZE)
+            i += 2;
+        crc ^= (uint16_t)h[i] << 8;
+        for (int b = 0; b < 8; b++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x8005 : crc << 1;
+    }
+
+    return crc;
+}
+
+// A feeder frame's own main data may have been cut away, and decoders disagree on what to
+// output for such a frame (minimp3 drops it). Zeroing its granules turns it into a silent frame
+// that reads nothing, while main_data_begin still spans the feeders before it, so the whole
+// copied payload stays in the reservoir for the frames that follow.
+static void mp3_make_reservoir_carrier(uint8_t *h, uint64_t reservoir_bytes) {
+    int crc  = HDR_IS_CRC(h) ? 2 : 0;
+    int side = mp3_side_info_size(h);
+    uint8_t *si = h + HDR_SIZE + crc;
+
+    memset(si, 0, side);
+
+    if (HDR_TEST_MPEG1(h)) {
+        unsigned mdb = (unsigned)MINIMP3_MIN(reservoir_bytes, MAX_BITRESERVOIR_BYTES);
+        si[0] = mdb >> 1;
+        si[1] = (mdb & 1) << 7;
+    } else {
+        si[0] = (uint8_t)MINIMP3_MIN(reservoir_bytes, 255);
+    }
+
+    if (crc) {
+        uint16_t v = mp3_frame_crc(h);
+        h[4] = v >> 8;
+        h[5] = v & 0xFF;
+    }
+}
+
+static void put_be32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+// Picks the header for the tag frame: the slice's own header, no CRC, no padding, and the
+// smallest bitrate the Xing + LAME tag fits in. Returns the frame size, 0 if none fits.
+static int info_frame_header(uint8_t *h, const uint8_t *ref_hdr, int free_format_bytes) {
+    memcpy(h, ref_hdr, HDR_SIZE);
+    h[1] |= 0x01;
+    h[2] &= ~0x02;
+
+    int needed = HDR_SIZE + mp3_side_info_size(h) + MP3_XING_SIZE + MP3_LAME_SIZE;
+    int bytes  = hdr_frame_bytes(h, free_format_bytes);
+
+    // free format cannot change size
+    while (!HDR_IS_FREE_FORMAT(h) && bytes < needed && HDR_GET_BITRATE(h) < 14) {
+        h[2] += 0x10;
+        bytes = hdr_frame_bytes(h, free_format_bytes);
+    }
+
+    return (bytes >= needed && bytes <= MAX_FREE_FORMAT_FRAME_SIZE) ? bytes : 0;
+}
+
+// Fills the Xing + LAME tag. The stream is: tag frame, `lead` silent frames of the same size,
+// then frames [first, last] of the input.
+static void build_info_frame(uint8_t *out, int out_bytes, const mp3_index_t *index, size_t first, size_t last,
+                             int lead, uint32_t enc_delay, uint32_t enc_padding, int is_vbr) {
+    int side = mp3_side_info_size(out);
+
+    size_t   nframes     = lead + last - first + 1;
+    uint64_t total_bytes = (uint64_t)out_bytes * (1 + lead);
+    for (size_t i = first; i <= last; i++)
+        total_bytes += index->frames[i].bytes;
+
+    uint8_t *x = out + HDR_SIZE + side;
+    memcpy(x, is_vbr ? "Xing" : "Info", 4);
+    put_be32(x + 4,  0x0F);         // frames, bytes, TOC, quality
+    put_be32(x + 8,  (uint32_t)nframes);
+    put_be32(x + 12, (uint32_t)total_bytes);
+
+    uint64_t acc = out_bytes;
+    size_t   f   = 0;
+    for (int i = 0; i < 100; i++) {
+        size_t target = (size_t)i * nframes / 100;
+        for (; f < target; f++)
+            acc += f < (size_t)lead ? (uint64_t)out_bytes : index->frames[first + f - lead].bytes;
+        x[16 + i] = (uint8_t)(acc * 256 / total_bytes);
+    }
+
+    uint8_t *lame = x + MP3_XING_SIZE;
+    memcpy(lame, "LAME3.100", 9);
+    lame[21] = enc_delay >> 4;
+    lame[22] = ((enc_delay & 0x0F) << 4) | (enc_padding >> 8);
+    lame[23] = enc_padding & 0xFF;
+    put_be32(lame + 28, (uint32_t)total_bytes);
+
+    uint16_t crc = crc16_arc(out, (size_t)(lame + 34 - out));
+    lame[34] = crc >> 8;
+    lame[35] = crc & 0xFF;
+}
+
+static int64_t mp3_reservoir_start(const mp3_frame_t *f) {
+    return (int64_t)f->payload_pos - f->main_data_begin;
+}
+
+// Writes [start, end) seconds as MP3. Leading frames that feed the bit reservoir of the first
+// kept frame are copied too, and a LAME tag tells gapless decoders how much to trim.
+// Times are on the trimmed timeline, so they match the decode path. Returns the bytes written
+// and sets *samples to the interleaved samples a gapless decoder will play, or returns -1.
+int64_t write_mp3_slice(const char *filename, const uint8_t *buf, const mp3_index_t *index, float start, float end,
+                        uint64_t *samples) {
+    uint64_t s0 = (uint64_t)(start * index->sample_rate) + index->trim_start;
+    uint64_t s1 = (uint64_t)(end * index->sample_rate) + index->trim_start;
+    size_t   first_audio = index->first_is_tag ? 1 : 0;
+
+    if (s1 > index->total_samples - index->trim_end)
+        s1 = index->total_samples - index->trim_end;
+
+    if (first_audio >= index->count || s0 >= s1) {
+        fprintf(stderr, "Invalid time range for %s: [%f, %f]\n", filename, start, end);
+        return -1;
+    }
+
+    size_t f0 = mp3_frame_at(index, s0);
+    size_t f1 = mp3_frame_at(index, s1 - 1);
+    if (f0 < first_audio)
+        f0 = first_audio;
+    if (f1 < f0)
+        f1 = f0;
+
+    // f0's QMF history comes from the previous granule, whose own output needs the IMDCT
+    // overlap of the one before: two warm-up granules, i.e. one frame for MPEG-1, two for MPEG-2
+    size_t warm = f0;
+    for (int gr = 0; gr < 2 && warm > first_audio; gr += index->frames[warm].samples / 576)
+        warm--;
+
+    // the warm-up frame and the first frames after it must find their main data in what is
+    // copied; main_data_begin is at most 511 bytes, so only the first few frames reach back
+    int64_t earliest = mp3_reservoir_start(&index->frames[warm]);
+    for (size_t i = warm + 1; i <= f1 && i < warm + 8; i++)
+        earliest = MINIMP3_MIN(earliest, mp3_reservoir_start(&index->frames[i]));
+
+    size_t lo = warm;
+    while (lo > first_audio && (int64_t)index->frames[lo].payload_pos > earliest)
+        lo--;
+
+    // the 12-bit delay field bounds how much priming can be trimmed away
+    while (lo < warm && s0 - index->frames[lo].sample > MP3_MAX_GAPLESS_FIELD + MP3_LAME_DECODER_DELAY)
+        lo++;
+
+    const uint8_t *ref_hdr = buf + index->frames[f0].offset;
+    int free_format_bytes  = HDR_IS_FREE_FORMAT(ref_hdr) ? (int)index->frames[f0].bytes - hdr_padding(ref_hdr) : 0;
+
+    uint8_t info[MAX_FREE_FORMAT_FRAME_SIZE];
+    int info_bytes = info_frame_header(info, ref_hdr, free_format_bytes);
+
+    // silent lead-in frames when the slice starts closer to the first copied sample than
+    // the decoder delay
+    const mp3_frame_t *last = &index->frames[f1];
+    int64_t skip = (int64_t)s0 - (int64_t)index->frames[lo].sample;
+    int     lead = 0;
+
+    while (info_bytes && skip < MP3_LAME_DECODER_DELAY) {
+        skip += hdr_frame_samples(info);
+        lead++;
+    }
+
+    uint32_t delay   = (uint32_t)MINIMP3_MAX(skip - MP3_LAME_DECODER_DELAY, 0);
+    uint32_t padding = (uint32_t)MINIMP3_MIN(last->sample + last->samples - s1 + MP3_LAME_DECODER_DELAY, MP3_MAX_GAPLESS_FIELD);
+
+    int is_vbr = lead && HDR_GET_BITRATE(info) != HDR_GET_BITRATE(ref_hdr);
+    for (size_t i = lo + 1; i <= f1 && !is_vbr; i++)
+        is_vbr = abs((int)index->frames[i].bytes - (int)index->frames[lo].bytes) > 1;
+
+    if (info_bytes) {
+        memset(info + HDR_SIZE, 0, info_bytes - HDR_SIZE);
+        build_info_frame(info, info_bytes, index, lo, f1, lead, delay, padding, is_vbr);
+    }
+
+    double t = trace_begin();
+    FILE *fout = fopen(filename, "wb");
+    if (!fout) {
+        perror("Error opening file for writing");
+        return -1;
+    }
+    trace_end("io", "open", t);
+
+    t = trace_begin();
+    int64_t written = (int64_t)info_bytes * (1 + lead);
+
+    if (info_bytes && fwrite(info, 1, info_bytes, fout) != (size_t)info_bytes) {
+        perror("Error writing MP3 header frame");
+        fclose(fout);
+        return -1;
+    }
+
+    if (lead) {
+        memset(info + HDR_SIZE, 0, info_bytes - HDR_SIZE);
+        for (int i = 0; i < lead; i++) {
+            if (fwrite(info, 1, info_bytes, fout) != (size_t)info_bytes) {
+                perror("Error writing MP3 data");
+                fclose(fout);
+                return -1;
+            }
+        }
+    }
+
+    // frames before the warm-up only feed the reservoir; if the delay cap cut into the
+    // feeders the warm-up frame cannot be decoded either and becomes a feeder as well
+    size_t verbatim = warm;
+    if (warm < f0 && mp3_reservoir_start(&index->frames[warm]) < (int64_t)index->frames[lo].payload_pos)
+        verbatim = warm + 1;
+
+    uint8_t carrier[MAX_FREE_FORMAT_FRAME_SIZE * 2];
+    size_t run = lo;
+
+    for (size_t i = lo; i <= f1; i++) {
+        const mp3_frame_t *f = &index->frames[i];
+        const uint8_t *h = buf + f->offset;
+
+        if (i < verbatim && HDR_GET_LAYER(h) == 1 && f->bytes <= sizeof(carrier)) {
+            memcpy(carrier, h, f->bytes);
+            mp3_make_reservoir_carrier(carrier, f->payload_pos - index->frames[lo].payload_pos);
+
+            if (fwrite(carrier, 1, f->bytes, fout) != f->bytes) {
+                perror("Error writing MP3 data");
+                fclose(fout);
+                return -1;
+            }
+            written += f->bytes;
+            run = i + 1;
+            continue;
+        }
+
+        // copy runs of adjacent frames in one go; runs only break where the input had junk
+        if (i != f1 && f->offset + f->bytes == index->frames[i + 1].offset)
+            continue;
+
+        uint64_t from = index->frames[run].offset;
+        uint64_t len  = f->offset + f->bytes - from;
+
+        if (fwrite(buf + from, 1, len, fout) != len) {
+            perror("Error writing MP3 data");
+            fclose(fout);
+            return -1;
+        }
+        written += len;
+        run = i + 1;
+    }
+
+    trace_end_arg("io", "write", t, "bytes", written);
+
+    // buffered data is flushed here, so a full disk may only show now
+    t = trace_begin();
+    int closed = fclose(fout);
+    trace_end("io", "close", t);
+
+    if (closed != 0) {
+        perror("Error writing MP3 data");
+        return -1;
+    }
+
+    log_info("%s MP3 frame copy written successfully.\n", filename);
+    *samples = (s1 - s0) * index->channels;
+    return written;
+}
@@ -0,0 +1,77 @@
+// ID3v2, ID3v1 and APEv2 tags around an MP3 stream, located from their headers so frame sync
+// never has to scan through them.
+
+#define ID3V2_HEADER_SIZE 10
+#define ID3V1_SIZE        128
+#define APE_FOOTER_SIZE   32
+
+#define ID3V2_FLAG_FOOTER 0x10
+#define APE_FLAG_HEADER   0x80000000u
+
+
+static uint32_t get_synchsafe32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 21) | ((uint32_t)p[1] << 14) | ((uint32_t)p[2] << 7) | p[3];
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+    return ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+}
+
+// Size of the ID3v2 header + body (+ footer) that `magic` ("ID3" or the "3DI" footer) starts,
+// 0 if p does not hold a valid one.
+static uint64_t id3v2_size(const uint8_t *p, const char *magic) {
+    if (memcmp(p, magic, 3) || p[3] == 0xFF || p[4] == 0xFF ||
+        ((p[6] | p[7] | p[8] | p[9]) & 0x80))
+        return 0;
+
+    uint64_t size = ID3V2_HEADER_SIZE + get_synchsafe32(p + 6);
+    return (p[5] & ID3V2_FLAG_FOOTER) ? size + ID3V2_HEADER_SIZE : size;
+}
+
+// Narrows [0, size) to the audio: past leading ID3v2 tags (several may be chained) and before
+// trailing ID3v1, APEv2 and appended ID3v2 tags, in whatever order they were stacked.
+void mp3_audio_range(const uint8_t *buf, uint64_t size, uint64_t *start, uint64_t *end) {
+    uint64_t lo = 0, hi = size;
+
+    while (hi - lo >= ID3V2_HEADER_SIZE) {
+        uint64_t tag = id3v2_size(buf + lo, "ID3");
+        if (!tag || tag > hi - lo)
+            break;
+        lo += tag;
+    }
+
+    for (;;) {
+        uint64_t len = hi - lo;
+
+        if (len >= ID3V1_SIZE && !memcmp(buf + hi - ID3V1_SIZE, "TAG", 3)) {
+            hi -= ID3V1_SIZE;
+            continue;
+        }
+
+        if (len >= APE_FOOTER_SIZE && !memcmp(buf + hi - APE_FOOTER_SIZE, "APETAGEX", 8)) {
+            const uint8_t *footer = buf + hi - APE_FOOTER_SIZE;
+            uint64_t tag = get_le32(footer + 12);   // items + footer
+
+            if (get_le32(footer + 20) & APE_FLAG_HEADER)
+                tag += APE_FOOTER_SIZE;
+
+            if (tag >= APE_FOOTER_SIZE && tag <= len) {
+                hi -= tag;
+                continue;
+            }
+        }
+
+        if (len >= ID3V2_HEADER_SIZE) {
+            uint64_t tag = id3v2_size(buf + hi - ID3V2_HEADER_SIZE, "3DI");
+            if (tag && tag <= len) {
+                hi -= tag;
+                continue;
+            }
+        }
+
+        break;
+    }
+
+    *start = lo;
+    *end   = hi;
+}
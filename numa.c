@@ -0,0 +1,87 @@
+// NUMA topology from /sys/devices/system/node, for pinning the task pool's workers with --pin.
+// Memory is placed by first touch from pinned workers, so no libnuma and no memory policies
+// are needed, only which CPUs belong to which node. Without the sysfs files (not Linux, or a
+// kernel without NUMA) the machine is one node holding every online CPU.
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#define NUMA_MAX_NODES 16
+#define NUMA_MAX_CPUS  1024
+
+typedef struct {
+    int nodes;                              // nodes with CPUs; memory-only nodes are left out
+    int count[NUMA_MAX_NODES];              // CPUs of each node
+    short cpus[NUMA_MAX_NODES][NUMA_MAX_CPUS];
+} numa_topology_t;
+
+
+// Parses a kernel CPU list ("0-15,32-47") into cpus. Returns the number of CPUs.
+static int numa_parse_cpulist(const char *list, short *cpus, int max) {
+    int count = 0;
+
+    while (*list && *list != '\n') {
+        char *end;
+        long first = strtol(list, &end, 10), last = first;
+
+        if (end == list)
+            break;
+        if (*end == '-')
+            last = strtol(end + 1, &end, 10);
+
+        for (long cpu = first; cpu <= last && count < max; cpu++)
+            if (cpu < NUMA_MAX_CPUS)
+                cpus[count++] = (short)cpu;
+
+        list = *end == ',' ? end + 1 : end;
+    }
+
+    return count;
+}
+
+void numa_topology(numa_topology_t *topo) {
+    char path[64], list[4096];
+
+    memset(topo, 0, sizeof(*topo));
+
+    for (int node = 0; node < NUMA_MAX_NODES; node++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+
+        FILE *f = fopen(path, "r");
+        if (!f)
+            continue;
+
+        if (fgets(list, sizeof(list), f)) {
+            int n = numa_parse_cpulist(list, topo->cpus[topo->nodes], NUMA_MAX_CPUS);
+            if (n > 0)
+                topo->count[topo->nodes++] = n;
+        }
+        fclose(f);
+    }
+
+    if (topo->nodes)
+        return;
+
+    long cpus      = sysconf(_SC_NPROCESSORS_ONLN);
+    topo->nodes    = 1;
+    topo->count[0] = (int)(cpus < 1 ? 1 : cpus > NUMA_MAX_CPUS ? NUMA_MAX_CPUS : cpus);
+    for (int i = 0; i < topo->count[0]; i++)
+        topo->cpus[0][i] = (short)i;
+}
+
+// Keeps the calling thread on one CPU. Returns 0, or -1 where that is not possible.
+int numa_pin_self(int cpu) {
+#if defined(__linux__) && defined(SYS_sched_setaffinity)
+    unsigned long mask[NUMA_MAX_CPUS / (8 * sizeof(unsigned long))] = { 0 };
+
+    if (cpu < 0 || cpu >= NUMA_MAX_CPUS)
+        return -1;
+
+    mask[cpu / (8 * sizeof(unsigned long))] = 1UL << (cpu % (8 * sizeof(unsigned long)));
+    return syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) == 0 ? 0 : -1;
+#else
+    (void)cpu;
+    return -1;
+#endif
+}
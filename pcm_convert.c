@@ -0,0 +1,243 @@
+// Conversion of WAV samples, as wav_parse() describes them, to the output sample type.
+// Needs the minimp3 implementation (HAVE_SSE, have_simd) and W_D_TYPE in the same unit.
+// Sources come straight from a mapped file, so every load is unaligned.
+
+#define PCM_S16_SCALE (1.0f / 32768.0f)
+#define PCM_S32_SCALE (1.0f / 2147483648.0f)
+
+static int32_t pcm_load_s24(const uint8_t *p) {
+    return (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) >> 8;
+}
+
+static int16_t pcm_float_to_s16(float x) {
+    x *= 32768.0f;
+    if (x >= 32767.0f)
+        return 32767;
+    if (x <= -32768.0f)
+        return -32768;
+    return (int16_t)(x + (x >= 0 ? 0.5f : -0.5f));
+}
+
+static void pcm_s16_to_float(float *dst, const uint8_t *src, size_t count) {
+    size_t i = 0;
+#if HAVE_SSE && defined(__AVX2__)
+    {
+        const __m256 scale = _mm256_set1_ps(PCM_S16_SCALE);
+        for (; i + 8 <= count; i += 8) {
+            __m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(src + 2 * i)));
+            _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+        }
+    }
+#endif
+#if HAVE_SSE
+    if (have_simd()) {
+        const __m128 scale = _mm_set1_ps(PCM_S16_SCALE);
+        for (; i + 8 <= count; i += 8) {
+            __m128i v  = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+            __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+            __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+            _mm_storeu_ps(dst + i,     _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+            _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        int16_t s;
+        memcpy(&s, src + 2 * i, 2);
+        dst[i] = s * PCM_S16_SCALE;
+    }
+}
+
+static void pcm_s24_to_float(float *dst, const uint8_t *src, size_t count) {
+    size_t i = 0;
+#if HAVE_SSE && defined(__AVX2__)
+    {
+        // 4 samples per 128-bit lane, each moved to the top of a 32-bit element
+        const __m256i spread = _mm256_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+                                                -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+        const __m256 scale   = _mm256_set1_ps(PCM_S32_SCALE);
+        for (; i + 10 <= count; i += 8) {
+            __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(src + 3 * i))),
+                                                _mm_loadu_si128((const __m128i *)(src + 3 * i + 12)), 1);
+            v = _mm256_shuffle_epi8(v, spread);
+            _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+        }
+    }
+#endif
+#if HAVE_SSE && defined(__SSSE3__)
+    if (have_simd()) {
+        // each 3-byte sample into the top of a 32-bit lane; 16-byte loads need 6 samples left
+        const __m128i spread = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+        const __m128 scale   = _mm_set1_ps(PCM_S32_SCALE);
+        for (; i + 6 <= count; i += 4) {
+            __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 3 * i)), spread);
+            _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+        }
+    }
+#endif
+    for (; i < count; i++)
+        dst[i] = (float)pcm_load_s24(src + 3 * i) * (1.0f / 8388608.0f);
+}
+
+static void pcm_s32_to_float(float *dst, const uint8_t *src, size_t count) {
+    size_t i = 0;
+#if HAVE_SSE && defined(__AVX2__)
+    {
+        const __m256 scale = _mm256_set1_ps(PCM_S32_SCALE);
+        for (; i + 8 <= count; i += 8) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(src + 4 * i));
+            _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+        }
+    }
+#endif
+#if HAVE_SSE
+    if (have_simd()) {
+        const __m128 scale = _mm_set1_ps(PCM_S32_SCALE);
+        for (; i + 4 <= count; i += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(src + 4 * i));
+            _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        int32_t s;
+        memcpy(&s, src + 4 * i, 4);
+        dst[i] = (float)s * PCM_S32_SCALE;
+    }
+}
+
+static void pcm_f32_to_s16(int16_t *dst, const uint8_t *src, size_t count) {
+    size_t i = 0;
+#if HAVE_SSE
+    if (have_simd()) {
+        // cvtps rounds to nearest and packs saturates, so only the scale is left to do
+        const __m128 scale = _mm_set1_ps(32768.0f);
+        for (; i + 8 <= count; i += 8) {
+            __m128i a = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps((const float *)(src + 4 * i)), scale));
+            __m128i b = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps((const float *)(src + 4 * i + 16)), scale));
+            _mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(a, b));
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        float s;
+        memcpy(&s, src + 4 * i, 4);
+        dst[i] = pcm_float_to_s16(s);
+    }
+}
+
+static void pcm_s24_to_s16(int16_t *dst, const uint8_t *src, size_t count) {
+    size_t i = 0;
+#if HAVE_SSE && defined(__SSSE3__)
+    if (have_simd()) {
+        // the top two bytes of 4 samples per load; the second load reads up to sample i + 9
+        const __m128i top = _mm_setr_epi8(1, 2, 4, 5, 7, 8, 10, 11, -1, -1, -1, -1, -1, -1, -1, -1);
+        for (; i + 10 <= count; i += 8) {
+            __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 3 * i)), top);
+            __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 3 * i + 12)), top);
+            _mm_storeu_si128((__m128i *)(dst + i), _mm_unpacklo_epi64(a, b));
+        }
+    }
+#endif
+    for (; i < count; i++)
+        dst[i] = (int16_t)(pcm_load_s24(src + 3 * i) >> 8);
+}
+
+static void pcm_s32_to_s16(int16_t *dst, const uint8_t *src, size_t count) {
+    size_t i = 0;
+#if HAVE_SSE
+    if (have_simd()) {
+        for (; i + 8 <= count; i += 8) {
+            __m128i a = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)(src + 4 * i)), 16);
+            __m128i b = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)(src + 4 * i + 16)), 16);
+            _mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(a, b));
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        int32_t s;
+        memcpy(&s, src + 4 * i, 4);
+        dst[i] = (int16_t)(s >> 16);
+    }
+}
+
+// Converts count samples (not frames) to float in [-1, 1), scaled as libsndfile does.
+void pcm_to_float(float *dst, const uint8_t *src, const wav_info_t *info, size_t count) {
+    if (info->format == WAV_FORMAT_FLOAT) {
+        if (info->bits_per_sample == 32) {
+            memcpy(dst, src, count * sizeof(float));
+        } else {
+            for (size_t i = 0; i < count; i++) {
+                double s;
+                memcpy(&s, src + 8 * i, 8);
+                dst[i] = (float)s;
+            }
+        }
+        return;
+    }
+
+    switch (info->bits_per_sample) {
+        case 8:
+            for (size_t i = 0; i < count; i++)
+                dst[i] = (src[i] - 128) * (1.0f / 128.0f);
+            break;
+        case 16:
+            pcm_s16_to_float(dst, src, count);
+            break;
+        case 24:
+            pcm_s24_to_float(dst, src, count);
+            break;
+        default:
+            pcm_s32_to_float(dst, src, count);
+            break;
+    }
+}
+
+// Converts count samples to 16-bit PCM; integer sources keep their top 16 bits.
+void pcm_to_s16(int16_t *dst, const uint8_t *src, const wav_info_t *info, size_t count) {
+    if (info->format == WAV_FORMAT_FLOAT) {
+        if (info->bits_per_sample == 32) {
+            pcm_f32_to_s16(dst, src, count);
+        } else {
+            for (size_t i = 0; i < count; i++) {
+                double s;
+                memcpy(&s, src + 8 * i, 8);
+                dst[i] = pcm_float_to_s16((float)s);
+            }
+        }
+        return;
+    }
+
+    switch (info->bits_per_sample) {
+        case 8:
+            for (size_t i = 0; i < count; i++)
+                dst[i] = (int16_t)((src[i] - 128) << 8);
+            break;
+        case 16:
+            memcpy(dst, src, count * sizeof(int16_t));
+            break;
+        case 24:
+            pcm_s24_to_s16(dst, src, count);
+            break;
+        default:
+            pcm_s32_to_s16(dst, src, count);
+            break;
+    }
+}
+
+// True if the samples are stored exactly as W_D_TYPE, so they can be used without conversion.
+int pcm_is_output_format(const wav_info_t *info) {
+#ifdef MINIMP3_FLOAT_OUTPUT
+    return info->format == WAV_FORMAT_FLOAT && info->bits_per_sample == 32;
+#else
+    return info->format == WAV_FORMAT_PCM && info->bits_per_sample == 16;
+#endif
+}
+
+void pcm_to_output(W_D_TYPE *dst, const uint8_t *src, const wav_info_t *info, size_t count) {
+#ifdef MINIMP3_FLOAT_OUTPUT
+    pcm_to_float(dst, src, info, count);
+#else
+    pcm_to_s16(dst, src, info, count);
+#endif
+}
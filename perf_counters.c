@@ -0,0 +1,118 @@
+// Hardware counters of the calling thread via perf_event_open, for --counters. Each counter
+// is opened on its own so that one the PMU lacks (cache-misses in many VMs) does not take the
+// others down with it; counts are scaled when the kernel had to multiplex them.
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+typedef enum {
+    PERF_INSTRUCTIONS,
+    PERF_CYCLES,
+    PERF_BRANCH_MISSES,
+    PERF_CACHE_MISSES,
+    PERF_COUNTER_COUNT
+} perf_counter_t;
+
+static const char *perf_counter_names[PERF_COUNTER_COUNT] = {
+    "instructions", "cycles", "branch_misses", "cache_misses"
+};
+
+typedef struct {
+    int fd[PERF_COUNTER_COUNT];     // -1 where the counter could not be opened
+} perf_group_t;
+
+typedef struct {
+    unsigned valid;                 // bit per perf_counter_t
+    uint64_t count[PERF_COUNTER_COUNT];
+} perf_values_t;
+
+
+#ifdef __linux__
+static const uint64_t perf_counter_config[PERF_COUNTER_COUNT] = {
+    PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES
+};
+
+// Counts user-space events of the calling thread only. Returns the number of counters opened.
+int perf_group_open(perf_group_t *g) {
+    int opened = 0;
+
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        struct perf_event_attr attr;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.size           = sizeof(attr);
+        attr.type           = PERF_TYPE_HARDWARE;
+        attr.config         = perf_counter_config[i];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        g->fd[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        opened += g->fd[i] >= 0;
+    }
+
+    return opened;
+}
+
+void perf_group_read(const perf_group_t *g, perf_values_t *v) {
+    memset(v, 0, sizeof(*v));
+
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        uint64_t r[3];      // value, time enabled, time running
+
+        if (g->fd[i] < 0 || read(g->fd[i], r, sizeof(r)) != sizeof(r))
+            continue;
+
+        if (r[2] && r[2] < r[1])
+            r[0] = (uint64_t)((double)r[0] * r[1] / r[2]);
+
+        v->count[i] = r[0];
+        v->valid   |= 1u << i;
+    }
+}
+
+void perf_group_close(perf_group_t *g) {
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (g->fd[i] >= 0)
+            close(g->fd[i]);
+        g->fd[i] = -1;
+    }
+}
+#else
+int perf_group_open(perf_group_t *g) {
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++)
+        g->fd[i] = -1;
+    return 0;
+}
+
+void perf_group_read(const perf_group_t *g, perf_values_t *v) {
+    (void)g;
+    memset(v, 0, sizeof(*v));
+}
+
+void perf_group_close(perf_group_t *g) {
+    (void)g;
+}
+#endif
+
+// acc += to - from, for the counters valid in both readings
+void perf_values_add_delta(perf_values_t *acc, const perf_values_t *from, const perf_values_t *to) {
+    unsigned valid = from->valid & to->valid;
+
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (valid & (1u << i))
+            acc->count[i] += to->count[i] - from->count[i];
+    }
+
+    acc->valid |= valid;
+}
+
+void perf_values_add(perf_values_t *acc, const perf_values_t *v) {
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++)
+        acc->count[i] += v->count[i];
+    acc->valid |= v->valid;
+}
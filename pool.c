@@ -0,0 +1,212 @@
+// Recycled buffers for decoded audio and slice copies, so that many files or slices in one process
+// (benchmark/bench.c, a fixed-length cut into hundreds of slices) do not map and fault in fresh
+// pages for each of them. Sizes are rounded up to a power of two from 64 KiB; free buffers of a
+// class wait in a small cache of the thread that released them, then in a shared list. Both count
+// against POOL_MAX_CACHED; a buffer freed past it is unmapped. Buffers are anonymous mappings, so
+// a new one still costs no memory until it is written. With pool_set_huge_pages() the large ones
+// are marked MADV_HUGEPAGE. Handouts are counted like mem_alloc() blocks, so --stats=json live and
+// peak bytes keep their meaning. Buffers from pool_alloc() must be released with pool_free().
+// Needs alloc.c in the same unit.
+
+#define POOL_MIN_SHIFT    16                    // smallest class, 64 KiB
+#define POOL_CLASSES      40
+#define POOL_HEADER       64                    // keeps the buffer 64-byte aligned
+#define POOL_THREAD_SLOTS 2                     // per class in each thread's cache
+#define POOL_THREAD_MAX   ((size_t)64 << 20)    // bigger buffers always go back to the shared lists
+#define POOL_MAX_CACHED   ((uint64_t)1 << 30)   // free bytes kept across all classes and threads
+#define POOL_HUGE_PAGE    ((size_t)2 << 20)
+
+typedef struct pool_block {
+    struct pool_block *next;    // in a free list
+    size_t size;                // of the mapping, header included
+    size_t requested;
+    int cls;
+} pool_block_t;
+
+typedef struct {
+    pool_block_t *slots[POOL_CLASSES][POOL_THREAD_SLOTS];
+    int count[POOL_CLASSES];
+} pool_cache_t;
+
+static struct {
+    pthread_mutex_t lock;
+    pool_block_t *free[POOL_CLASSES];
+} pool_shared = { PTHREAD_MUTEX_INITIALIZER, { 0 } };
+
+static atomic_uint_fast64_t pool_cached;    // free bytes, in thread caches and shared lists
+static atomic_uint_fast64_t pool_hits, pool_misses;
+static int pool_huge;
+static pthread_key_t pool_key;
+static pthread_once_t pool_key_once = PTHREAD_ONCE_INIT;
+static __thread pool_cache_t *pool_local;
+
+
+static int pool_class(size_t size) {
+    for (int cls = 0; cls < POOL_CLASSES; cls++)
+        if (size <= (size_t)1 << (POOL_MIN_SHIFT + cls))
+            return cls;
+    return -1;
+}
+
+// b is already counted in pool_cached.
+static void pool_release_shared(pool_block_t *b) {
+    pthread_mutex_lock(&pool_shared.lock);
+    b->next                  = pool_shared.free[b->cls];
+    pool_shared.free[b->cls] = b;
+    pthread_mutex_unlock(&pool_shared.lock);
+}
+
+// A thread's cache outlives it in the shared lists.
+static void pool_flush_thread(void *arg) {
+    pool_cache_t *cache = arg;
+
+    for (int cls = 0; cls < POOL_CLASSES; cls++)
+        for (int i = 0; i < cache->count[cls]; i++)
+            pool_release_shared(cache->slots[cls][i]);
+    free(cache);
+}
+
+static void pool_make_key(void) {
+    pthread_key_create(&pool_key, pool_flush_thread);
+}
+
+static pool_cache_t *pool_thread_cache(void) {
+    if (!pool_local) {
+        pthread_once(&pool_key_once, pool_make_key);
+        pool_local = calloc(1, sizeof(*pool_local));
+        if (pool_local)
+            pthread_setspecific(pool_key, pool_local);
+    }
+    return pool_local;
+}
+
+static pool_block_t *pool_take(int cls) {
+    pool_cache_t *cache = pool_thread_cache();
+    pool_block_t *b     = NULL;
+
+    if (cache && cache->count[cls]) {
+        b = cache->slots[cls][--cache->count[cls]];
+    } else {
+        pthread_mutex_lock(&pool_shared.lock);
+        if ((b = pool_shared.free[cls]))
+            pool_shared.free[cls] = b->next;
+        pthread_mutex_unlock(&pool_shared.lock);
+    }
+
+    if (b)
+        atomic_fetch_sub_explicit(&pool_cached, b->size, memory_order_relaxed);
+    return b;
+}
+
+static pool_block_t *pool_map(int cls) {
+    size_t size = (size_t)1 << (POOL_MIN_SHIFT + cls);
+    void *map   = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (map == MAP_FAILED)
+        return NULL;
+
+#ifdef MADV_HUGEPAGE
+    if (pool_huge && size >= POOL_HUGE_PAGE)
+        madvise(map, size, MADV_HUGEPAGE);
+#endif
+
+    pool_block_t *b = map;
+    b->size = size;
+    b->cls  = cls;
+    return b;
+}
+
+static pool_block_t *pool_get(size_t size) {
+    if (size > SIZE_MAX - POOL_HEADER)
+        return NULL;
+
+    int cls = pool_class(size + POOL_HEADER);
+    if (cls < 0)
+        return NULL;
+
+    pool_block_t *b = pool_take(cls);
+
+    if (b)
+        atomic_fetch_add_explicit(&pool_hits, 1, memory_order_relaxed);
+    else if ((b = pool_map(cls)))
+        atomic_fetch_add_explicit(&pool_misses, 1, memory_order_relaxed);
+
+    if (b)
+        b->requested = size;
+    return b;
+}
+
+// Keeps b for reuse, or unmaps it if that would take the free buffers past POOL_MAX_CACHED.
+static void pool_put(pool_block_t *b) {
+    if (atomic_fetch_add_explicit(&pool_cached, b->size, memory_order_relaxed) + b->size > POOL_MAX_CACHED) {
+        atomic_fetch_sub_explicit(&pool_cached, b->size, memory_order_relaxed);
+        munmap(b, b->size);
+        return;
+    }
+
+    pool_cache_t *cache = b->size <= POOL_THREAD_MAX ? pool_thread_cache() : NULL;
+
+    if (cache && cache->count[b->cls] < POOL_THREAD_SLOTS)
+        cache->slots[b->cls][cache->count[b->cls]++] = b;
+    else
+        pool_release_shared(b);
+}
+
+// Marks buffers mapped from now on for transparent huge pages, where the kernel has them.
+void pool_set_huge_pages(int on) {
+    pool_huge = on;
+}
+
+// At least size bytes, 64-byte aligned. The contents are undefined: a recycled buffer keeps
+// whatever its last user left in it.
+void *pool_alloc(size_t size) {
+    pool_block_t *b = pool_get(size);
+
+    if (!b)
+        return NULL;
+
+    atomic_fetch_add_explicit(&mem_allocs, 1, memory_order_relaxed);
+    mem_account((int64_t)size);
+    return (uint8_t *)b + POOL_HEADER;
+}
+
+void pool_free(void *ptr) {
+    if (!ptr)
+        return;
+
+    pool_block_t *b = (pool_block_t *)((uint8_t *)ptr - POOL_HEADER);
+
+    atomic_fetch_add_explicit(&mem_frees, 1, memory_order_relaxed);
+    mem_account(-(int64_t)b->requested);
+    pool_put(b);
+}
+
+// Grows or shrinks in place while the size fits the buffer's class, else moves to another.
+void *pool_realloc(void *ptr, size_t size) {
+    if (!ptr)
+        return pool_alloc(size);
+
+    pool_block_t *b = (pool_block_t *)((uint8_t *)ptr - POOL_HEADER);
+    size_t old      = b->requested;
+
+    if (size <= SIZE_MAX - POOL_HEADER && size + POOL_HEADER <= b->size) {
+        b->requested = size;
+    } else {
+        pool_block_t *moved = pool_get(size);
+        if (!moved)
+            return NULL;
+
+        memcpy((uint8_t *)moved + POOL_HEADER, ptr, old < size ? old : size);
+        pool_put(b);
+        b = moved;
+    }
+
+    atomic_fetch_add_explicit(&mem_reallocs, 1, memory_order_relaxed);
+    mem_account((int64_t)size - (int64_t)old);
+    return (uint8_t *)b + POOL_HEADER;
+}
+
+void pool_counts(uint64_t *hits, uint64_t *misses) {
+    *hits   = atomic_load_explicit(&pool_hits, memory_order_relaxed);
+    *misses = atomic_load_explicit(&pool_misses, memory_order_relaxed);
+}
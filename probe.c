@@ -0,0 +1,265 @@
+// Header-only probing for --probe: format, codec, rate, channels, bitrate, exact duration and
+// tag bytes of MP3 and WAV files, without decoding. MP3 duration comes from the Xing/Info or
+// VBRI frame count when there is one and from a walk over the frame headers otherwise; WAV
+// comes from the RIFF chunk headers. Needs map_file, the MP3 helpers and the task
+// pool of main.c.
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdatomic.h>
+
+typedef struct {
+    audio_type type;
+    const char *codec;          // "mp3", or the WAV sample format ("pcm_s16le", ...)
+    int sample_rate;
+    int channels;
+    int bits_per_sample;        // 0 for MP3
+    uint32_t bitrate;           // bits per second, averaged over the audio data
+    int vbr;
+    uint64_t samples;           // per channel, on the gapless timeline for MP3
+    double duration;
+    const char *duration_source;    // "xing", "vbri", "frames" or "header"
+    uint64_t file_bytes;
+    uint64_t audio_bytes;
+    uint64_t tag_bytes;         // ID3v2/ID3v1/APE for MP3, chunks other than fmt/data for WAV
+} probe_info_t;
+
+typedef struct {
+    char **paths;
+    size_t count;
+    size_t capacity;
+    atomic_int failed;
+    pthread_mutex_t out_lock;
+    FILE *out;
+} probe_job_t;
+
+
+static const char *probe_mp3(const uint8_t *buf, uint64_t size, probe_info_t *info) {
+    uint64_t start, end;
+    vbr_tag_t tag;
+
+    mp3_audio_range(buf, size, &start, &end);
+    info->audio_bytes = end - start;
+    info->tag_bytes   = size - info->audio_bytes;
+
+    int64_t first = find_vbr_tag(buf + start, end - start, &tag);
+    if (first < 0)
+        return "no MPEG audio frames";
+
+    uint64_t trim_start, trim_end;
+    vbr_tag_trim(&tag, &trim_start, &trim_end);
+
+    info->codec       = "mp3";
+    info->sample_rate = tag.sample_rate;
+    info->channels    = tag.channels;
+
+    if (tag.frames) {
+        info->samples         = (uint64_t)tag.frames * tag.frame_samples;
+        info->vbr             = tag.type == VBR_TAG_XING || tag.type == VBR_TAG_VBRI;
+        info->duration_source = tag.type == VBR_TAG_VBRI ? "vbri" : "xing";
+    } else {
+        // no frame count: step over every frame header
+        info->samples         = mp3_count_samples(buf, start + first, end, &info->vbr);
+        info->duration_source = "frames";
+    }
+
+    if (trim_start + trim_end < info->samples)
+        info->samples -= trim_start + trim_end;
+
+    return NULL;
+}
+
+static const char *probe_wav(const uint8_t *buf, uint64_t size, probe_info_t *info) {
+    wav_info_t wav;
+
+    if (wav_parse(buf, size, &wav) != 0)
+        return "not a PCM or float WAVE file";
+
+    info->codec           = wav_codec_name(&wav);
+    info->sample_rate     = wav.sample_rate;
+    info->channels        = wav.channels;
+    info->bits_per_sample = wav.bits_per_sample;
+    info->samples         = wav.frames;
+    info->audio_bytes     = wav.data_bytes;
+    info->tag_bytes       = wav.other_bytes;
+    info->duration_source = "header";
+    return NULL;
+}
+
+// Fills info from the headers of filename. Returns NULL, or why the file could not be probed;
+// info->type and info->file_bytes are set either way when the file could be read.
+const char *probe_file(const char *filename, probe_info_t *info) {
+    uint64_t size;
+    const char *error;
+
+    memset(info, 0, sizeof(*info));
+
+    const uint8_t *buf = map_file(filename, &size);
+    if (!buf)
+        return "cannot read file";
+
+    // only headers are touched, so reading ahead would fetch pages nobody looks at
+    madvise((void *)buf, size, MADV_RANDOM);
+
+    info->file_bytes = size;
+    info->type       = detect_audio_buffer(buf, size);
+
+    switch (info->type) {
+        case AUDIO_MPEG:
+            error = probe_mp3(buf, size, info);
+            break;
+        case AUDIO_WAV:
+            error = probe_wav(buf, size, info);
+            break;
+        default:
+            error = "unsupported format";
+            break;
+    }
+
+    unmap_file(buf, size);
+
+    if (!error && info->sample_rate > 0) {
+        info->duration = (double)info->samples / info->sample_rate;
+        if (info->duration > 0)
+            info->bitrate = (uint32_t)(info->audio_bytes * 8 / info->duration + 0.5);
+    }
+
+    return error;
+}
+
+void probe_print_json(FILE *out, const char *filename, const probe_info_t *info, const char *error) {
+    fprintf(out, "{\"file\": ");
+    stats_json_string(out, filename);
+    fprintf(out, ", \"format\": \"%s\", \"file_bytes\": %llu", get_mime_type(info->type), (unsigned long long)info->file_bytes);
+
+    if (error) {
+        fprintf(out, ", \"error\": \"%s\"}\n", error);
+        return;
+    }
+
+    fprintf(out, ", \"codec\": \"%s\", \"sample_rate\": %d, \"channels\": %d, ", info->codec, info->sample_rate, info->channels);
+    if (info->bits_per_sample)
+        fprintf(out, "\"bits_per_sample\": %d, ", info->bits_per_sample);
+    fprintf(out, "\"bitrate\": %u, \"vbr\": %s, \"samples\": %llu, \"duration\": %.6f, \"duration_source\": \"%s\", "
+                 "\"audio_bytes\": %llu, \"tag_bytes\": %llu}\n",
+            info->bitrate, info->vbr ? "true" : "false", (unsigned long long)info->samples, info->duration,
+            info->duration_source, (unsigned long long)info->audio_bytes, (unsigned long long)info->tag_bytes);
+}
+
+static int probe_add_path(probe_job_t *job, const char *path) {
+    if (job->count == job->capacity) {
+        size_t capacity = job->capacity ? job->capacity * 2 : 1024;
+        char **grown    = mem_realloc(job->paths, capacity * sizeof(char *));
+
+        if (!grown)
+            return -1;
+        job->paths    = grown;
+        job->capacity = capacity;
+    }
+
+    if (!(job->paths[job->count] = mem_strdup(path)))
+        return -1;
+    job->count++;
+    return 0;
+}
+
+// A path that cannot be listed gets its error line right away; nothing else writes to out
+// until the files are probed.
+static void probe_collect_failed(probe_job_t *job, const char *path) {
+    const char *error = strerror(errno);
+    probe_info_t info;
+
+    memset(&info, 0, sizeof(info));
+    atomic_fetch_add(&job->failed, 1);
+    probe_print_json(job->out, path, &info, error);
+}
+
+// Adds path, or every regular file below it if it is a directory; hidden entries are skipped.
+static int probe_collect(probe_job_t *job, const char *path) {
+    struct stat st;
+
+    if (stat(path, &st) != 0) {
+        probe_collect_failed(job, path);
+        return 0;
+    }
+
+    if (!S_ISDIR(st.st_mode))
+        return S_ISREG(st.st_mode) ? probe_add_path(job, path) : 0;
+
+    DIR *dir = opendir(path);
+    if (!dir) {
+        probe_collect_failed(job, path);
+        return 0;
+    }
+
+    struct dirent *entry;
+    char full[4096];
+    int rc = 0;
+
+    while (rc == 0 && (entry = readdir(dir))) {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        snprintf(full, sizeof(full), "%s/%s", path, entry->d_name);
+        rc = probe_collect(job, full);
+    }
+
+    closedir(dir);
+    return rc;
+}
+
+static void probe_task(void *arg, size_t i) {
+    probe_job_t *job = arg;
+    probe_info_t info;
+    const char *error = probe_file(job->paths[i], &info);
+
+    if (error)
+        atomic_fetch_add(&job->failed, 1);
+
+    // format the line first, so the lock only covers one write
+    char *line = NULL;
+    size_t len = 0;
+    FILE *mem  = open_memstream(&line, &len);
+    if (!mem)
+        return;
+
+    probe_print_json(mem, job->paths[i], &info, error);
+    fclose(mem);
+
+    pthread_mutex_lock(&job->out_lock);
+    fwrite(line, 1, len, job->out);
+    pthread_mutex_unlock(&job->out_lock);
+    free(line);
+}
+
+// Probes every file under paths, one task per file, and writes one JSON object per line to
+// out, in completion order. Returns the number of files that could not be probed, or -1.
+int probe_paths(char *paths[], int count, FILE *out) {
+    probe_job_t job;
+    sched_group_t group = { 0 };
+    int failed = 0;
+
+    memset(&job, 0, sizeof(job));
+    job.out = out;
+    pthread_mutex_init(&job.out_lock, NULL);
+
+    for (int i = 0; i < count; i++) {
+        if (probe_collect(&job, paths[i]) != 0) {
+            fprintf(stderr, "Memory allocation failed\n");
+            failed = -1;
+            break;
+        }
+    }
+
+    // with --pin, each NUMA node starts on its own share of the list
+    for (size_t i = 0; i < job.count && failed == 0; i++)
+        sched_submit_node(&group, probe_task, &job, i, sched_node_of(i, job.count));
+    sched_wait(&group);
+
+    for (size_t i = 0; i < job.count; i++)
+        mem_free(job.paths[i]);
+    mem_free(job.paths);
+    pthread_mutex_destroy(&job.out_lock);
+
+    return failed ? failed : atomic_load(&job.failed);
+}
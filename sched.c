@@ -0,0 +1,363 @@
+// Work-stealing task pool shared by everything that runs in parallel: WAV conversion blocks,
+// slice writes and probed files are all tasks on the same workers, so a core that finishes
+// its share early takes work from one that has not, instead of waiting behind it.
+//
+// Each worker owns a deque. It pushes and pops its own tasks at the bottom, newest first, and
+// once it runs dry steals the oldest task from the top of another worker's deque. Threads
+// outside the pool hand their tasks out round-robin and run queued tasks themselves while
+// they wait for a group. A task is a function, an argument and an index, so a loop over n
+// items is n submissions with no allocation per item. Tasks are blocks and files, long next
+// to a lock hand-off, so each deque is simply guarded by a mutex.
+//
+// With sched_set_pinning() each worker is kept on one CPU, spread over the NUMA nodes. Tasks
+// can then be sent to a node (sched_submit_node), and workers steal from their own node before
+// reaching across to another, so data first touched by one node's workers stays with them.
+// With sched_set_timing() each worker also adds up the wall and CPU time of the tasks it runs.
+// Needs MINIMP3_MIN/MAX, mem_*, trace_* and numa.c in the same unit.
+
+#include <stdatomic.h>
+
+#define SCHED_MIN_WORKERS 4         // writes wait on the disk more than on a core
+#define SCHED_MAX_WORKERS 64
+
+typedef void (*sched_fn)(void *arg, size_t index);
+
+// Tasks that are waited for together; zero-initialise before the first submission.
+typedef struct {
+    atomic_long pending;        // submitted and not finished
+} sched_group_t;
+
+typedef struct {
+    sched_fn fn;
+    void *arg;
+    size_t index;
+    sched_group_t *group;
+} sched_task_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    sched_task_t *tasks;        // ring, tasks[head] is the top
+    size_t capacity;
+    size_t head;
+    size_t count;
+} sched_deque_t;
+
+// What one worker spent running tasks, with sched_set_timing().
+typedef struct {
+    double busy_ms;             // wall time inside tasks
+    double cpu_ms;              // thread CPU time inside tasks
+    uint64_t tasks;
+} sched_worker_stats_t;
+
+static struct {
+    atomic_int workers;         // only grows, and only while the pool starts
+    sched_deque_t deques[SCHED_MAX_WORKERS];
+    pthread_t threads[SCHED_MAX_WORKERS];
+    int cpu[SCHED_MAX_WORKERS]; // CPU each worker is pinned to, -1 if not pinned
+    int node[SCHED_MAX_WORKERS];
+    int nodes;                  // nodes the workers are pinned across, 1 without pinning
+    sched_worker_stats_t times[SCHED_MAX_WORKERS];  // each written only by its own worker
+    atomic_uint next_on_node[NUMA_MAX_NODES];
+    atomic_long queued;         // tasks in all deques
+    atomic_int sleepers;
+    atomic_int waiters;         // sleepers waiting for a group rather than for tasks
+    atomic_uint next_deque;     // round-robin for threads outside the pool
+    atomic_int stop;
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle;        // a task was queued, a waited group progressed, or stop
+} sched;
+
+static pthread_once_t sched_once = PTHREAD_ONCE_INIT;
+static int sched_started;
+static int sched_pin;
+static int sched_timing;
+static int sched_joined;        // workers sched_shutdown() joined, whose times can be read
+static __thread int sched_self = -1;    // this thread's deque, -1 outside the pool
+
+
+static int sched_deque_push(sched_deque_t *d, const sched_task_t *task) {
+    pthread_mutex_lock(&d->lock);
+
+    if (d->count == d->capacity) {
+        size_t capacity     = d->capacity ? d->capacity * 2 : 256;
+        sched_task_t *grown = mem_alloc(capacity * sizeof(*grown));
+
+        if (!grown) {
+            pthread_mutex_unlock(&d->lock);
+            return -1;
+        }
+
+        for (size_t i = 0; i < d->count; i++)
+            grown[i] = d->tasks[(d->head + i) % d->capacity];
+        mem_free(d->tasks);
+        d->tasks    = grown;
+        d->capacity = capacity;
+        d->head     = 0;
+    }
+
+    d->tasks[(d->head + d->count) % d->capacity] = *task;
+    d->count++;
+
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+}
+
+// Takes the newest task (the owner) or the oldest (a thief). Returns 0 if the deque is empty.
+static int sched_deque_take(sched_deque_t *d, int newest, sched_task_t *task) {
+    int found = 0;
+
+    pthread_mutex_lock(&d->lock);
+
+    if (d->count) {
+        if (newest) {
+            *task = d->tasks[(d->head + d->count - 1) % d->capacity];
+        } else {
+            *task   = d->tasks[d->head];
+            d->head = (d->head + 1) % d->capacity;
+        }
+        d->count--;
+        found = 1;
+    }
+
+    pthread_mutex_unlock(&d->lock);
+    return found;
+}
+
+static void sched_wake(int all) {
+    // sleepers count themselves before they look at what they wait for, so either they see
+    // the change or they are counted here
+    if (!atomic_load(&sched.sleepers))
+        return;
+
+    pthread_mutex_lock(&sched.idle_lock);
+    if (all)
+        pthread_cond_broadcast(&sched.idle);
+    else
+        pthread_cond_signal(&sched.idle);
+    pthread_mutex_unlock(&sched.idle_lock);
+}
+
+static double sched_clock(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Runs one queued task on this thread: its own newest, else one stolen. Returns 0 if none.
+static int sched_run_one(void) {
+    sched_task_t task;
+    int self  = sched_self;
+    int found = self >= 0 && sched_deque_take(&sched.deques[self], 1, &task);
+
+    if (!found) {
+        unsigned first = self >= 0 ? (unsigned)self + 1 : atomic_fetch_add(&sched.next_deque, 1);
+        int workers    = sched.workers;
+
+        // workers on this node first, then the rest
+        for (int pass = self >= 0 && sched.nodes > 1 ? 0 : 1; pass < 2 && !found; pass++) {
+            for (int i = 0; i < workers && !found; i++) {
+                int victim = (int)((first + i) % workers);
+                if (victim != self && (pass || sched.node[victim] == sched.node[self]))
+                    found = sched_deque_take(&sched.deques[victim], 0, &task);
+            }
+        }
+    }
+
+    if (!found)
+        return 0;
+
+    atomic_fetch_sub(&sched.queued, 1);
+
+    // tasks run by a thread waiting outside the pool are counted in its own stage times
+    if (self >= 0 && sched_timing) {
+        sched_worker_stats_t *w = &sched.times[self];
+        double wall = sched_clock(CLOCK_MONOTONIC);
+        double cpu  = sched_clock(CLOCK_THREAD_CPUTIME_ID);
+
+        task.fn(task.arg, task.index);
+
+        w->busy_ms += (sched_clock(CLOCK_MONOTONIC) - wall) * 1e3;
+        w->cpu_ms  += (sched_clock(CLOCK_THREAD_CPUTIME_ID) - cpu) * 1e3;
+        w->tasks++;
+    } else {
+        task.fn(task.arg, task.index);
+    }
+
+    // the group may be gone as soon as its count drops, so nothing of it is read after
+    atomic_fetch_sub(&task.group->pending, 1);
+    if (atomic_load(&sched.waiters))
+        sched_wake(1);
+
+    return 1;
+}
+
+// Sleeps until a task is queued, or group has no more than target tasks pending.
+static void sched_sleep(sched_group_t *group, long target) {
+    pthread_mutex_lock(&sched.idle_lock);
+    atomic_fetch_add(&sched.sleepers, 1);
+    if (group)
+        atomic_fetch_add(&sched.waiters, 1);
+
+    while (atomic_load(&sched.queued) <= 0 && !atomic_load(&sched.stop) &&
+           (!group || atomic_load(&group->pending) > target))
+        pthread_cond_wait(&sched.idle, &sched.idle_lock);
+
+    if (group)
+        atomic_fetch_sub(&sched.waiters, 1);
+    atomic_fetch_sub(&sched.sleepers, 1);
+    pthread_mutex_unlock(&sched.idle_lock);
+}
+
+static void *sched_worker(void *arg) {
+    sched_self = (int)(intptr_t)arg;
+    trace_thread_name("worker");
+
+    if (sched.cpu[sched_self] >= 0 && numa_pin_self(sched.cpu[sched_self]) != 0)
+        fprintf(stderr, "Could not pin worker %d to CPU %d\n", sched_self, sched.cpu[sched_self]);
+
+    while (!atomic_load(&sched.stop)) {
+        if (!sched_run_one())
+            sched_sleep(NULL, 0);
+    }
+
+    return NULL;
+}
+
+static void sched_start(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int n     = (int)MINIMP3_MIN(MINIMP3_MAX(cpus, SCHED_MIN_WORKERS), SCHED_MAX_WORKERS);
+
+    pthread_mutex_init(&sched.idle_lock, NULL);
+    pthread_cond_init(&sched.idle, NULL);
+
+    for (int i = 0; i < n; i++) {
+        pthread_mutex_init(&sched.deques[i].lock, NULL);
+        sched.cpu[i] = -1;
+    }
+
+    sched.nodes = 1;
+    if (sched_pin) {
+        static numa_topology_t topo;
+        numa_topology(&topo);
+
+        // worker i on node i % nodes, so any number of workers is spread evenly
+        sched.nodes = MINIMP3_MIN(topo.nodes, n);
+        for (int i = 0; i < n; i++) {
+            int node      = i % sched.nodes;
+            sched.node[i] = node;
+            sched.cpu[i]  = topo.cpus[node][(i / sched.nodes) % topo.count[node]];
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (pthread_create(&sched.threads[i], NULL, sched_worker, (void *)(intptr_t)i) != 0) {
+            fprintf(stderr, "Error creating worker %d, running with %d\n", i, i);
+            break;
+        }
+        atomic_store(&sched.workers, i + 1);
+    }
+
+    sched_started = 1;
+}
+
+// Pins the workers to CPUs, node by node. Only has an effect before the pool's first use.
+void sched_set_pinning(int pin) {
+    sched_pin = pin;
+}
+
+// Times the tasks each worker runs, see sched_worker_stats(). Only has an effect before the
+// pool's first use.
+void sched_set_timing(int timing) {
+    sched_timing = timing;
+}
+
+// Workers in the pool, starting it on first use; 0 if no thread could be created.
+int sched_size(void) {
+    pthread_once(&sched_once, sched_start);
+    return sched.workers;
+}
+
+// The calling thread's worker number, -1 outside the pool.
+int sched_worker_index(void) {
+    return sched_self;
+}
+
+// Queues fn(arg, index) as part of group, for a worker on node if node >= 0 and the workers
+// are pinned across nodes. Without a pool, or without memory for a longer deque, the task runs
+// right here instead.
+void sched_submit_node(sched_group_t *group, sched_fn fn, void *arg, size_t index, int node) {
+    sched_task_t task = { fn, arg, index, group };
+
+    atomic_fetch_add(&group->pending, 1);
+
+    if (sched_size() > 0) {
+        int d;
+
+        if (node >= 0 && sched.nodes > 1 && (sched_self < 0 || sched.node[sched_self] != node % sched.nodes)) {
+            // the node's workers are every nodes-th one, starting at the node's number
+            node %= sched.nodes;
+            int on_node = (sched.workers - node + sched.nodes - 1) / sched.nodes;
+            d = on_node > 0 ? node + (int)(atomic_fetch_add(&sched.next_on_node[node], 1) % on_node) * sched.nodes : 0;
+        } else {
+            d = sched_self >= 0 ? sched_self : (int)(atomic_fetch_add(&sched.next_deque, 1) % sched.workers);
+        }
+
+        if (sched_deque_push(&sched.deques[d], &task) == 0) {
+            atomic_fetch_add(&sched.queued, 1);
+            sched_wake(0);
+            return;
+        }
+    }
+
+    fn(arg, index);
+    atomic_fetch_sub(&group->pending, 1);
+}
+
+// The node that position of total belongs to when data is split evenly over the nodes, or -1
+// when the workers are not pinned across nodes.
+int sched_node_of(uint64_t position, uint64_t total) {
+    if (!sched_pin || total == 0 || sched_size() == 0 || sched.nodes < 2)
+        return -1;
+
+    return (int)MINIMP3_MIN((double)position / total * sched.nodes, sched.nodes - 1);
+}
+
+// Runs queued tasks, the group's or any other, until no more than target of its tasks are
+// pending. Waiting for 0 is waiting for the whole group.
+void sched_wait_until(sched_group_t *group, long target) {
+    while (atomic_load(&group->pending) > target) {
+        if (!sched_run_one())
+            sched_sleep(group, target);
+    }
+}
+
+void sched_wait(sched_group_t *group) {
+    sched_wait_until(group, 0);
+}
+
+// Stops and joins the workers, which must have nothing queued. The pool cannot be restarted.
+void sched_shutdown(void) {
+    if (!sched_started)
+        return;
+
+    atomic_store(&sched.stop, 1);
+    pthread_mutex_lock(&sched.idle_lock);
+    pthread_cond_broadcast(&sched.idle);
+    pthread_mutex_unlock(&sched.idle_lock);
+
+    for (int i = 0; i < sched.workers; i++) {
+        pthread_join(sched.threads[i], NULL);
+        mem_free(sched.deques[i].tasks);
+        pthread_mutex_destroy(&sched.deques[i].lock);
+    }
+
+    sched_joined = sched.workers;
+    atomic_store(&sched.workers, 0);
+}
+
+// Per-worker task times, once sched_shutdown() has joined the workers. Returns how many there
+// were, 0 if the pool never started.
+int sched_worker_stats(const sched_worker_stats_t **stats) {
+    *stats = sched.times;
+    return sched_joined;
+}
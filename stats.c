@@ -0,0 +1,308 @@
+// Run statistics for --stats=json: stage timings, byte and sample counts, per-slice writer
+// times, per-worker task times, allocations and page faults per stage, peak RSS, plus hardware
+// counters with --counters. Needs sched.c in the same unit.
+
+#include <sys/resource.h>
+
+typedef enum {
+    STATS_DETECT,
+    STATS_READ,
+    STATS_DECODE,
+    STATS_PLAN,
+    STATS_WRITE,
+    STATS_STAGE_COUNT
+} stats_stage_t;
+
+static const char *stats_stage_names[STATS_STAGE_COUNT] = {
+    "detect", "read", "decode", "plan", "write"
+};
+
+// Filled by the thread writing the slice; each thread owns its entry.
+typedef struct {
+    double begin_ms;            // since the start of the run
+    double wall_ms;
+    double cpu_ms;              // thread CPU time
+    uint64_t bytes;             // bytes written, 0 if the slice failed
+    uint64_t samples;           // interleaved samples written
+    perf_values_t perf;         // the writer thread's counters, with --counters
+    perf_values_t worker_perf;  // the part of perf counted on pool workers, not the main thread
+} slice_stats_t;
+
+// Process-wide, so the write stage includes its writer threads.
+typedef struct {
+    uint64_t allocs;
+    uint64_t reallocs;
+    uint64_t frees;
+    uint64_t bytes;             // requested from mem_alloc and friends
+    int64_t peak_live;          // highest live heap bytes during the stage
+    long minor_faults;
+    long major_faults;
+} stage_mem_t;
+
+// Start of a measurement on the thread that will end it.
+typedef struct {
+    double wall;
+    double cpu;
+    perf_group_t group;
+    perf_values_t perf;
+} stats_timer_t;
+
+typedef struct {
+    double start;               // CLOCK_MONOTONIC seconds at startup
+    double stage_ms[STATS_STAGE_COUNT];
+    uint64_t bytes_in;
+    uint64_t frames_decoded;    // MPEG frames, 0 for WAV input
+    uint64_t samples_decoded;   // interleaved samples
+    unsigned slice_count;
+    slice_stats_t slices[MAX_SLICES];
+
+    int counters;               // collect hardware counters
+    perf_group_t perf;          // main thread's counters, read at each stage boundary
+    perf_values_t perf_last;
+    perf_values_t stage_perf[STATS_STAGE_COUNT];
+
+    stage_mem_t stage_mem[STATS_STAGE_COUNT];
+    mem_stats_t mem_last;
+    struct rusage ru_last;
+} run_stats_t;
+
+
+double stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+double stats_thread_cpu(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void stats_init(run_stats_t *stats, int counters) {
+    memset(stats, 0, sizeof(*stats));
+
+    if (counters) {
+        if (perf_group_open(&stats->perf) == 0)
+            fprintf(stderr, "Hardware counters unavailable (perf_event_open failed), reporting none\n");
+        stats->counters = 1;
+        perf_group_read(&stats->perf, &stats->perf_last);
+    }
+
+    mem_snapshot(&stats->mem_last);
+    mem_reset_peak();
+    getrusage(RUSAGE_SELF, &stats->ru_last);
+
+    stats->start = stats_now();
+}
+
+void stats_close(run_stats_t *stats) {
+    if (stats->counters)
+        perf_group_close(&stats->perf);
+}
+
+// Adds the time since `since` to a stage and returns the current time, so stages chain.
+// Counters are charged from the previous stage boundary, on the main thread.
+double stats_stage(run_stats_t *stats, stats_stage_t stage, double since) {
+    double now = stats_now();
+    stats->stage_ms[stage] += (now - since) * 1e3;
+
+    // same clock, in microseconds
+    trace_end("stage", stats_stage_names[stage], since * 1e6);
+
+    if (stats->counters) {
+        perf_values_t perf;
+        perf_group_read(&stats->perf, &perf);
+        perf_values_add_delta(&stats->stage_perf[stage], &stats->perf_last, &perf);
+        stats->perf_last = perf;
+    }
+
+    mem_stats_t mem;
+    struct rusage ru;
+    stage_mem_t *sm = &stats->stage_mem[stage];
+
+    mem_snapshot(&mem);
+    mem_reset_peak();
+    getrusage(RUSAGE_SELF, &ru);
+
+    sm->allocs       += mem.allocs - stats->mem_last.allocs;
+    sm->reallocs     += mem.reallocs - stats->mem_last.reallocs;
+    sm->frees        += mem.frees - stats->mem_last.frees;
+    sm->bytes        += mem.bytes - stats->mem_last.bytes;
+    sm->peak_live     = MINIMP3_MAX(sm->peak_live, mem.peak);
+    sm->minor_faults += ru.ru_minflt - stats->ru_last.ru_minflt;
+    sm->major_faults += ru.ru_majflt - stats->ru_last.ru_majflt;
+
+    stats->mem_last = mem;
+    stats->ru_last  = ru;
+
+    return now;
+}
+
+void stats_slice_begin(const run_stats_t *stats, slice_stats_t *slice, stats_timer_t *timer) {
+    if (stats->counters) {
+        perf_group_open(&timer->group);
+        perf_group_read(&timer->group, &timer->perf);
+    }
+
+    timer->wall = stats_now();
+    timer->cpu  = stats_thread_cpu();
+    slice->begin_ms = (timer->wall - stats->start) * 1e3;
+}
+
+void stats_slice_end(const run_stats_t *stats, slice_stats_t *slice, stats_timer_t *timer, uint64_t bytes, uint64_t samples) {
+    slice->wall_ms = (stats_now() - timer->wall) * 1e3;
+    slice->cpu_ms  = (stats_thread_cpu() - timer->cpu) * 1e3;
+    slice->bytes   = bytes;
+    slice->samples = samples;
+
+    if (stats->counters) {
+        perf_values_t perf;
+        perf_group_read(&timer->group, &perf);
+        perf_values_add_delta(&slice->perf, &timer->perf, &perf);
+        if (sched_worker_index() >= 0)
+            perf_values_add_delta(&slice->worker_perf, &timer->perf, &perf);
+        perf_group_close(&timer->group);
+    }
+}
+
+// stats_slice_end() for one part of a slice written in parts, each maybe on another thread:
+// times, bytes and samples add up, and begin_ms stays that of the first part.
+void stats_slice_add(const run_stats_t *stats, slice_stats_t *slice, stats_timer_t *timer, uint64_t bytes, uint64_t samples, int first) {
+    slice_stats_t before = *slice;
+
+    stats_slice_end(stats, slice, timer, bytes, samples);
+    if (first)
+        return;
+
+    slice->begin_ms = before.begin_ms;
+    slice->wall_ms += before.wall_ms;
+    slice->cpu_ms  += before.cpu_ms;
+    slice->bytes   += before.bytes;
+    slice->samples += before.samples;
+}
+
+static long peak_rss_kb(void) {
+    struct rusage ru;
+    return getrusage(RUSAGE_SELF, &ru) == 0 ? ru.ru_maxrss : -1;
+}
+
+static void stats_print_counters(FILE *out, const perf_values_t *v) {
+    fputc('{', out);
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        fprintf(out, "%s\"%s\": ", i ? ", " : "", perf_counter_names[i]);
+        if (v->valid & (1u << i))
+            fprintf(out, "%llu", (unsigned long long)v->count[i]);
+        else
+            fprintf(out, "null");
+    }
+
+    unsigned ipc = (1u << PERF_INSTRUCTIONS) | (1u << PERF_CYCLES);
+    if ((v->valid & ipc) == ipc && v->count[PERF_CYCLES])
+        fprintf(out, ", \"ipc\": %.3f}", (double)v->count[PERF_INSTRUCTIONS] / v->count[PERF_CYCLES]);
+    else
+        fprintf(out, ", \"ipc\": null}");
+}
+
+static void stats_json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', out);
+        if ((unsigned char)*s < 0x20)
+            fprintf(out, "\\u%04x", *s);
+        else
+            fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+void stats_print_json(FILE *out, const run_stats_t *stats, const char *input, const char *type, const char *format,
+                      float lengths[][2], const char *names[]) {
+    uint64_t bytes_out = 0, samples_written = 0;
+
+    for (unsigned i = 0; i < stats->slice_count; i++) {
+        bytes_out       += stats->slices[i].bytes;
+        samples_written += stats->slices[i].samples;
+    }
+
+    fprintf(out, "{\n  \"input\": ");
+    stats_json_string(out, input);
+    fprintf(out, ",\n  \"type\": \"%s\",\n  \"output\": \"%s\",\n  \"stages_ms\": {", type, format);
+
+    for (int s = 0; s < STATS_STAGE_COUNT; s++)
+        fprintf(out, "%s\"%s\": %.3f", s ? ", " : "", stats_stage_names[s], stats->stage_ms[s]);
+
+    fprintf(out, ", \"total\": %.3f},\n", (stats_now() - stats->start) * 1e3);
+
+    if (stats->counters) {
+        // the write stage is the main thread plus the workers; slices the main thread wrote,
+        // inline or while waiting, are already in its own stage counters
+        perf_values_t write = stats->stage_perf[STATS_WRITE];
+        for (unsigned i = 0; i < stats->slice_count; i++)
+            perf_values_add(&write, &stats->slices[i].worker_perf);
+
+        fprintf(out, "  \"counters\": {");
+        for (int s = 0; s < STATS_STAGE_COUNT; s++) {
+            fprintf(out, "%s\n    \"%s\": ", s ? "," : "", stats_stage_names[s]);
+            stats_print_counters(out, s == STATS_WRITE ? &write : &stats->stage_perf[s]);
+        }
+        fprintf(out, "\n  },\n");
+    }
+    fprintf(out, "  \"bytes_in\": %llu,\n  \"bytes_out\": %llu,\n", (unsigned long long)stats->bytes_in, (unsigned long long)bytes_out);
+    fprintf(out, "  \"frames_decoded\": %llu,\n  \"samples_decoded\": %llu,\n  \"samples_written\": %llu,\n",
+            (unsigned long long)stats->frames_decoded, (unsigned long long)stats->samples_decoded,
+            (unsigned long long)samples_written);
+    mem_stats_t mem;
+    uint64_t pool_hits, pool_misses;
+    mem_snapshot(&mem);
+    pool_counts(&pool_hits, &pool_misses);
+
+    fprintf(out, "  \"memory\": {\"allocs\": %llu, \"reallocs\": %llu, \"frees\": %llu, \"bytes\": %llu, \"peak_live_bytes\": %lld, "
+                 "\"pool_hits\": %llu, \"pool_misses\": %llu, \"stages\": {",
+            (unsigned long long)mem.allocs, (unsigned long long)mem.reallocs, (unsigned long long)mem.frees,
+            (unsigned long long)mem.bytes, (long long)mem_peak_live(),
+            (unsigned long long)pool_hits, (unsigned long long)pool_misses);
+
+    for (int s = 0; s < STATS_STAGE_COUNT; s++) {
+        const stage_mem_t *sm = &stats->stage_mem[s];
+
+        fprintf(out, "%s\n    \"%s\": {\"allocs\": %llu, \"reallocs\": %llu, \"frees\": %llu, \"bytes\": %llu, "
+                     "\"peak_live_bytes\": %lld, \"minor_faults\": %ld, \"major_faults\": %ld}",
+                s ? "," : "", stats_stage_names[s], (unsigned long long)sm->allocs, (unsigned long long)sm->reallocs,
+                (unsigned long long)sm->frees, (unsigned long long)sm->bytes, (long long)sm->peak_live,
+                sm->minor_faults, sm->major_faults);
+    }
+
+    fprintf(out, "\n  }},\n");
+    fprintf(out, "  \"peak_rss_kb\": %ld,\n  \"slices\": [", peak_rss_kb());
+
+    for (unsigned i = 0; i < stats->slice_count; i++) {
+        const slice_stats_t *sl = &stats->slices[i];
+
+        fprintf(out, "%s\n    {\"name\": ", i ? "," : "");
+        stats_json_string(out, names[i]);
+        fprintf(out, ", \"start\": %.3f, \"end\": %.3f, \"begin_ms\": %.3f, \"wall_ms\": %.3f, \"cpu_ms\": %.3f, "
+                     "\"bytes\": %llu, \"samples\": %llu, \"ok\": %s",
+                lengths[i][0], lengths[i][1], sl->begin_ms, sl->wall_ms, sl->cpu_ms,
+                (unsigned long long)sl->bytes, (unsigned long long)sl->samples, sl->bytes ? "true" : "false");
+
+        if (stats->counters) {
+            fprintf(out, ", \"counters\": ");
+            stats_print_counters(out, &sl->perf);
+        }
+        fputc('}', out);
+    }
+
+    const sched_worker_stats_t *workers;
+    int worker_count = sched_worker_stats(&workers);
+
+    fprintf(out, "%s],\n  \"workers\": [", stats->slice_count ? "\n  " : "");
+
+    for (int i = 0; i < worker_count; i++) {
+        fprintf(out, "%s\n    {\"worker\": %d, \"busy_ms\": %.3f, \"cpu_ms\": %.3f, \"tasks\": %llu}",
+                i ? "," : "", i, workers[i].busy_ms, workers[i].cpu_ms, (unsigned long long)workers[i].tasks);
+    }
+
+    fprintf(out, "%s]\n}\n", worker_count ? "\n  " : "");
+}
@@ -0,0 +1,168 @@
+// Timeline of what each thread was doing, written as Chrome trace JSON (chrome://tracing,
+// ui.perfetto.dev) with --trace=<file>. Every thread appends to its own buffer, found through
+// a thread-local pointer, so recording takes no lock; the buffers are linked into a list once,
+// on a thread's first event, and only read after all workers have been joined.
+//
+// When tracing is off, trace_begin() returns 0 and trace_end() returns after one load.
+
+#include <stdatomic.h>
+
+typedef struct {
+    const char *cat;            // string literals only, they are not copied
+    const char *name;
+    const char *arg_name;       // NULL for no argument
+    int64_t arg;
+    double ts;                  // microseconds since trace_start()
+    double dur;
+} trace_event_t;
+
+typedef struct trace_buffer {
+    int tid;
+    char name[64];
+    size_t count;
+    size_t capacity;
+    size_t dropped;
+    trace_event_t *events;
+    struct trace_buffer *next;
+} trace_buffer_t;
+
+static int trace_enabled;                       // set before any worker starts
+static double trace_origin;
+static atomic_int trace_next_tid;
+static _Atomic(trace_buffer_t *) trace_buffers;
+static __thread trace_buffer_t *trace_local;
+
+
+static double trace_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec * 1e-3;
+}
+
+void trace_start(void) {
+    trace_origin  = trace_clock();
+    trace_enabled = 1;
+}
+
+static trace_buffer_t *trace_thread_buffer(void) {
+    if (trace_local)
+        return trace_local;
+
+    trace_buffer_t *b = calloc(1, sizeof(trace_buffer_t));
+    if (!b)
+        return NULL;
+
+    b->tid = atomic_fetch_add(&trace_next_tid, 1) + 1;
+    snprintf(b->name, sizeof(b->name), "thread %d", b->tid);
+
+    b->next = atomic_load(&trace_buffers);
+    while (!atomic_compare_exchange_weak(&trace_buffers, &b->next, b))
+        ;
+
+    trace_local = b;
+    return b;
+}
+
+// Names the calling thread's track.
+void trace_thread_name(const char *name) {
+    if (!trace_enabled)
+        return;
+
+    trace_buffer_t *b = trace_thread_buffer();
+    if (b)
+        snprintf(b->name, sizeof(b->name), "%s", name);
+}
+
+double trace_begin(void) {
+    return trace_enabled ? trace_clock() : 0;
+}
+
+// Records a span from `begin` (a trace_begin() value) until now, with an optional numeric argument.
+void trace_end_arg(const char *cat, const char *name, double begin, const char *arg_name, int64_t arg) {
+    if (!trace_enabled)
+        return;
+
+    double now = trace_clock();
+    trace_buffer_t *b = trace_thread_buffer();
+    if (!b)
+        return;
+
+    if (b->count == b->capacity) {
+        size_t capacity = b->capacity ? b->capacity * 2 : 256;
+        trace_event_t *grown = realloc(b->events, capacity * sizeof(trace_event_t));
+
+        if (!grown) {
+            b->dropped++;
+            return;
+        }
+        b->events   = grown;
+        b->capacity = capacity;
+    }
+
+    trace_event_t *e = &b->events[b->count++];
+    e->cat      = cat;
+    e->name     = name;
+    e->arg_name = arg_name;
+    e->arg      = arg;
+    e->ts       = begin - trace_origin;
+    e->dur      = now - begin;
+}
+
+void trace_end(const char *cat, const char *name, double begin) {
+    trace_end_arg(cat, name, begin, NULL, 0);
+}
+
+// Writes and frees every thread's events. Only call once the recording threads have finished.
+int trace_write(const char *filename) {
+    FILE *fout = fopen(filename, "w");
+    if (!fout) {
+        perror("Error opening trace file for writing");
+        return -1;
+    }
+
+    trace_buffer_t *b = atomic_exchange(&trace_buffers, NULL);
+    int first = 1;
+
+    fprintf(fout, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+
+    while (b) {
+        trace_buffer_t *next = b->next;
+
+        fprintf(fout, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"",
+                first ? "" : ",", b->tid);
+        for (const char *c = b->name; *c; c++) {
+            if (*c == '"' || *c == '\\')
+                fputc('\\', fout);
+            if ((unsigned char)*c >= 0x20)
+                fputc(*c, fout);
+        }
+        fprintf(fout, "\"}}");
+        first = 0;
+
+        if (b->dropped)
+            fprintf(stderr, "Trace: %zu events of %s dropped, out of memory\n", b->dropped, b->name);
+
+        for (size_t i = 0; i < b->count; i++) {
+            const trace_event_t *e = &b->events[i];
+
+            fprintf(fout, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+                          "\"ts\": %.3f, \"dur\": %.3f", e->name, e->cat, b->tid, e->ts, e->dur);
+            if (e->arg_name)
+                fprintf(fout, ", \"args\": {\"%s\": %lld}", e->arg_name, (long long)e->arg);
+            fputc('}', fout);
+        }
+
+        free(b->events);
+        free(b);
+        b = next;
+    }
+
+    fprintf(fout, "\n]}\n");
+    trace_local = NULL;
+
+    if (fclose(fout) != 0) {
+        perror("Error writing trace file");
+        return -1;
+    }
+    return 0;
+}
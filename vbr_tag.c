@@ -0,0 +1,162 @@
+// Xing/Info, VBRI and LAME tags carried in the first frame of an MP3 stream.
+// Needs the minimp3 implementation (HDR_* macros, hdr_* helpers) in the same unit.
+
+#define MP3_LAME_DECODER_DELAY 529     /* samples a LAME-aware decoder adds to the encoder delay */
+#define MP3_MAX_GAPLESS_FIELD  4095    /* 12-bit delay/padding fields of the LAME tag            */
+#define MP3_XING_SIZE          120     /* tag + flags + frames + bytes + TOC + quality           */
+#define MP3_LAME_SIZE          36
+#define MP3_VBRI_OFFSET        (HDR_SIZE + 32)
+
+#define XING_FLAG_FRAMES  0x1
+#define XING_FLAG_BYTES   0x2
+#define XING_FLAG_TOC     0x4
+#define XING_FLAG_QUALITY 0x8
+
+typedef enum {
+    VBR_TAG_NONE = 0,
+    VBR_TAG_XING,
+    VBR_TAG_INFO,
+    VBR_TAG_VBRI
+} vbr_tag_type;
+
+typedef struct {
+    vbr_tag_type type;
+    uint32_t frames;            // audio frames, the tag frame itself excluded (0 if unknown)
+    uint32_t bytes;             // stream bytes (0 if unknown)
+    int sample_rate;
+    int channels;
+    int frame_samples;          // samples per channel in each frame
+    int has_lame;
+    uint16_t enc_delay;         // LAME encoder delay in samples
+    uint16_t enc_padding;       // LAME padding in samples
+} vbr_tag_t;
+
+
+static int mp3_side_info_size(const uint8_t *h) {
+    if (HDR_TEST_MPEG1(h))
+        return HDR_IS_MONO(h) ? 17 : 32;
+    return HDR_IS_MONO(h) ? 9 : 17;
+}
+
+static uint32_t get_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint16_t get_be16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint16_t crc16_arc(const uint8_t *data, size_t len) {
+    uint16_t crc = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+    }
+
+    return crc;
+}
+
+// The LAME extension has no magic of its own: accept it when its CRC holds or a known encoder wrote it.
+static int parse_lame_ext(const uint8_t *frame, const uint8_t *lame, vbr_tag_t *tag) {
+    uint16_t crc = crc16_arc(frame, (size_t)(lame + 34 - frame));
+
+    if (crc != get_be16(lame + 34) &&
+        memcmp(lame, "LAME", 4) && memcmp(lame, "Lavc", 4) && memcmp(lame, "Lavf", 4))
+        return 0;
+
+    tag->has_lame    = 1;
+    tag->enc_delay   = (lame[21] << 4) | (lame[22] >> 4);
+    tag->enc_padding = ((lame[22] & 0x0F) << 8) | lame[23];
+    return 1;
+}
+
+static int parse_xing(const uint8_t *h, int frame_bytes, vbr_tag_t *tag) {
+    const uint8_t *x   = h + HDR_SIZE + mp3_side_info_size(h);
+    const uint8_t *end = h + frame_bytes;
+
+    if (x + 8 > end || (memcmp(x, "Xing", 4) && memcmp(x, "Info", 4)))
+        return 0;
+
+    uint32_t flags = get_be32(x + 4);
+    const uint8_t *p = x + 8;
+
+    tag->type = memcmp(x, "Info", 4) ? VBR_TAG_XING : VBR_TAG_INFO;
+
+    if ((flags & XING_FLAG_FRAMES) && p + 4 <= end) {
+        tag->frames = get_be32(p);
+        p += 4;
+    }
+    if ((flags & XING_FLAG_BYTES) && p + 4 <= end) {
+        tag->bytes = get_be32(p);
+        p += 4;
+    }
+    if (flags & XING_FLAG_TOC)
+        p += 100;
+    if (flags & XING_FLAG_QUALITY)
+        p += 4;
+
+    if (p + MP3_LAME_SIZE <= end)
+        parse_lame_ext(h, p, tag);
+
+    return 1;
+}
+
+static int parse_vbri(const uint8_t *h, int frame_bytes, vbr_tag_t *tag) {
+    const uint8_t *v = h + MP3_VBRI_OFFSET;
+
+    if (MP3_VBRI_OFFSET + 26 > frame_bytes || memcmp(v, "VBRI", 4))
+        return 0;
+
+    // the VBRI delay field is not applied: encoders disagree on what it counts
+    tag->type   = VBR_TAG_VBRI;
+    tag->bytes  = get_be32(v + 10);
+    tag->frames = get_be32(v + 14);
+    return 1;
+}
+
+// Looks for a VBR tag in the frame at h. Returns 1 when the frame is a tag frame, which
+// decoders must skip: it carries no audio.
+int parse_vbr_tag(const uint8_t *h, int frame_bytes, vbr_tag_t *tag) {
+    memset(tag, 0, sizeof(*tag));
+
+    tag->sample_rate   = hdr_sample_rate_hz(h);
+    tag->channels      = HDR_IS_MONO(h) ? 1 : 2;
+    tag->frame_samples = hdr_frame_samples(h);
+
+    if (HDR_GET_LAYER(h) != 1)
+        return 0;
+
+    return parse_xing(h, frame_bytes, tag) || parse_vbri(h, frame_bytes, tag);
+}
+
+// Locates the first frame of buf and parses its tag. Returns the offset decoding should start
+// at, past the tag frame if there is one, or -1 when buf holds no frame.
+int64_t find_vbr_tag(const uint8_t *buf, uint64_t size, vbr_tag_t *tag) {
+    int free_format_bytes = 0, frame_bytes = 0;
+    int window = (int)MINIMP3_MIN(size, (uint64_t)INT32_MAX);
+    int skip   = mp3d_find_frame(buf, window, &free_format_bytes, &frame_bytes);
+
+    memset(tag, 0, sizeof(*tag));
+
+    if (!frame_bytes || (uint64_t)skip + frame_bytes > size)
+        return -1;
+
+    if (parse_vbr_tag(buf + skip, frame_bytes, tag))
+        return skip + frame_bytes;
+
+    return skip;
+}
+
+// Samples per channel a gapless decoder drops from the start and end of the decoded stream.
+void vbr_tag_trim(const vbr_tag_t *tag, uint64_t *start, uint64_t *end) {
+    *start = 0;
+    *end   = 0;
+
+    if (!tag->has_lame)
+        return;
+
+    *start = tag->enc_delay + MP3_LAME_DECODER_DELAY;
+    *end   = tag->enc_padding > MP3_LAME_DECODER_DELAY ? tag->enc_padding - MP3_LAME_DECODER_DELAY : 0;
+}
@@ -1,7 +1,8 @@
 #include <stdint.h>
 
-#define WAV_FORMAT_PCM   0x0001
-#define WAV_FORMAT_FLOAT 0x0003
+#define WAV_FORMAT_PCM        0x0001
+#define WAV_FORMAT_FLOAT      0x0003
+#define WAV_FORMAT_EXTENSIBLE 0xFFFE
 
 #pragma pack(push, 1)
 typedef struct {
@@ -22,6 +23,21 @@ typedef struct {
 #pragma pack(pop)             /* to restore the shaped ( remove compiler padding */
 
 
+// What the chunk headers of a RIFF or RF64 WAVE file say.
+typedef struct {
+    int format;               /* WAV_FORMAT_PCM or WAV_FORMAT_FLOAT, EXTENSIBLE resolved   */
+    int channels;
+    int sample_rate;
+    int bits_per_sample;
+    int block_align;          /* bytes per frame                                         */
+    uint64_t data_offset;     /* of the samples in the file                              */
+    uint64_t data_bytes;      /* whole frames only, cut short if the file is truncated   */
+    uint64_t frames;
+    uint64_t other_bytes;     /* chunks that are neither fmt nor data: LIST, bext, id3...*/
+    int is_rf64;
+} wav_info_t;
+
+
 static void init_wav_header(wav_header* header, int format_tag, int channels, int sample_rate, int bits_per_sample, uint32_t data_length) {
     memcpy(header->riff, "RIFF", 4);
     memcpy(header->wave, "WAVE", 4);
@@ -46,11 +62,15 @@ int write_pcm_wav(const char *filename, const int16_t *pcm, uint32_t sample_coun
     
     init_wav_header(&header, WAV_FORMAT_PCM, channels, sample_rate, 16, data_length);
 
+    double t = trace_begin();
     FILE *fout = fopen(filename, "wb");
     if (!fout) {
         perror("Error opening file for writing");
         return -1;
     }
+    trace_end("io", "open", t);
+
+    t = trace_begin();
 
     if (fwrite(&header, sizeof(header), 1, fout) != 1) {
         perror("Error writing WAV header");
@@ -63,12 +83,19 @@ int write_pcm_wav(const char *filename, const int16_t *pcm, uint32_t sample_coun
         fclose(fout);
         return -1;
     }
-    else{
-        printf("%s PCM 16bit WAV file written successfully.\n",filename);
-    }
 
+    trace_end_arg("io", "write", t, "bytes", sizeof(header) + data_length);
+
+    t = trace_begin();
+    int closed = fclose(fout);
+    trace_end("io", "close", t);
 
-    fclose(fout);
+    if (closed != 0) {
+        perror("Error writing WAV data");
+        return -1;
+    }
+
+    log_info("%s PCM 16bit WAV file written successfully.\n",filename);
     return 0;
 }
 
@@ -79,11 +106,15 @@ int write_float_wav(const char *filename, const float *pcm, uint32_t sample_coun
 
     init_wav_header(&header,WAV_FORMAT_FLOAT, channels, sample_rate, 32, data_length);
     
+    double t = trace_begin();
     FILE *fout = fopen(filename, "wb");
     if (!fout) {
         perror("Error opening file for writing");
         return -1;
     }
+    trace_end("io", "open", t);
+
+    t = trace_begin();
 
     if (fwrite(&header, sizeof(header), 1, fout) != 1) {
         perror("Error writing WAV header");
@@ -96,10 +127,195 @@ int write_float_wav(const char *filename, const float *pcm, uint32_t sample_coun
         fclose(fout);
         return -1;
     }
-    else{
-        printf("%s Float 32 bit WAV file written successfully.\n",filename);
+
+    trace_end_arg("io", "write", t, "bytes", sizeof(header) + data_length);
+
+    t = trace_begin();
+    int closed = fclose(fout);
+    trace_end("io", "close", t);
+
+    if (closed != 0) {
+        perror("Error writing WAV data");
+        return -1;
     }
 
-    fclose(fout);
+    log_info("%s Float 32 bit WAV file written successfully.\n",filename);
     return 0;
 }
+
+// A WAV file written in parts, for a slice whose samples are never all in memory at once. The
+// header goes out first with no length and is rewritten by wav_stream_close(), so the finished
+// file is the same as write_pcm_wav() or write_float_wav() would make of the whole slice.
+typedef struct {
+    FILE *f;
+    int format_tag;
+    int channels;
+    int sample_rate;
+    int bits_per_sample;
+    uint64_t data_length;
+    int failed;                 // a write failed; the file is closed without a valid header
+} wav_stream_t;
+
+int wav_stream_open(wav_stream_t *w, const char *filename, int format_tag, int channels, int sample_rate, int bits_per_sample) {
+    wav_header header;
+
+    memset(w, 0, sizeof(*w));
+    w->format_tag      = format_tag;
+    w->channels        = channels;
+    w->sample_rate     = sample_rate;
+    w->bits_per_sample = bits_per_sample;
+
+    init_wav_header(&header, format_tag, channels, sample_rate, bits_per_sample, 0);
+
+    double t = trace_begin();
+    w->f = fopen(filename, "wb");
+    if (!w->f) {
+        perror("Error opening file for writing");
+        return -1;
+    }
+    trace_end("io", "open", t);
+
+    if (fwrite(&header, sizeof(header), 1, w->f) != 1) {
+        perror("Error writing WAV header");
+        fclose(w->f);
+        w->f = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+int wav_stream_write(wav_stream_t *w, const void *samples, size_t bytes) {
+    double t = trace_begin();
+
+    if (w->failed || fwrite(samples, 1, bytes, w->f) != bytes) {
+        if (!w->failed)
+            perror("Error writing WAV data");
+        w->failed = 1;
+        return -1;
+    }
+
+    w->data_length += bytes;
+    trace_end_arg("io", "write", t, "bytes", bytes);
+    return 0;
+}
+
+// Fills in the lengths and closes the file. Returns 0, or -1 if any part failed.
+int wav_stream_close(wav_stream_t *w, const char *filename) {
+    wav_header header;
+    int rc = w->failed ? -1 : 0;
+
+    init_wav_header(&header, w->format_tag, w->channels, w->sample_rate, w->bits_per_sample, (uint32_t)w->data_length);
+
+    if (rc == 0 && (fseek(w->f, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, w->f) != 1)) {
+        perror("Error writing WAV header");
+        rc = -1;
+    }
+
+    double t = trace_begin();
+    if (fclose(w->f) != 0 && rc == 0) {
+        perror("Error writing WAV data");
+        rc = -1;
+    }
+    trace_end("io", "close", t);
+    w->f = NULL;
+
+    if (rc == 0)
+        log_info("%s %s WAV file written successfully.\n", filename,
+                 w->format_tag == WAV_FORMAT_FLOAT ? "Float 32 bit" : "PCM 16bit");
+    return rc;
+}
+
+static uint16_t wav_le16(const uint8_t *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t wav_le32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t wav_le64(const uint8_t *p) {
+    return wav_le32(p) | (uint64_t)wav_le32(p + 4) << 32;
+}
+
+// Walks the chunk headers of buf, a whole WAV file (usually mapped, so only the pages with
+// chunk headers are read). Unknown chunks are skipped. Returns 0, or -1 if the file is not
+// a WAVE file with integer PCM of 8-32 bits or float samples of 32/64 bits.
+int wav_parse(const uint8_t *buf, uint64_t size, wav_info_t *info) {
+    memset(info, 0, sizeof(*info));
+
+    if (size < 12 || memcmp(buf + 8, "WAVE", 4) != 0)
+        return -1;
+
+    info->is_rf64 = memcmp(buf, "RF64", 4) == 0;
+    if (!info->is_rf64 && memcmp(buf, "RIFF", 4) != 0)
+        return -1;
+
+    uint64_t ds64_data = 0, pos = 12;
+    int have_fmt = 0, have_data = 0;
+
+    while (pos + 8 <= size) {
+        const uint8_t *chunk = buf + pos;
+        uint64_t body = pos + 8;
+        uint64_t chunk_size = wav_le32(chunk + 4);
+
+        if (memcmp(chunk, "ds64", 4) == 0 && chunk_size >= 24 && body + 24 <= size) {
+            ds64_data = wav_le64(buf + body + 8);
+        } else if (memcmp(chunk, "fmt ", 4) == 0 && chunk_size >= 16 && body + 16 <= size) {
+            const uint8_t *fmt = buf + body;
+
+            info->format          = wav_le16(fmt);
+            info->channels        = wav_le16(fmt + 2);
+            info->sample_rate     = (int)wav_le32(fmt + 4);
+            info->block_align     = wav_le16(fmt + 12);
+            info->bits_per_sample = wav_le16(fmt + 14);
+
+            // the sub-format GUID starts with the format tag it stands for
+            if (info->format == WAV_FORMAT_EXTENSIBLE && chunk_size >= 40 && body + 40 <= size)
+                info->format = wav_le16(fmt + 24);
+            have_fmt = 1;
+        } else if (memcmp(chunk, "data", 4) == 0 && !have_data) {
+            if (info->is_rf64 && chunk_size == 0xFFFFFFFF)
+                chunk_size = ds64_data;
+
+            // writers that never finalised the header leave 0 or 0xFFFFFFFF
+            if (chunk_size == 0 || chunk_size > size - body)
+                chunk_size = size - body;
+
+            info->data_offset = body;
+            info->data_bytes  = chunk_size;
+            have_data = 1;
+        } else {
+            info->other_bytes += 8 + chunk_size;
+        }
+
+        if (chunk_size > size - body)
+            break;
+        pos = body + chunk_size + (chunk_size & 1);
+    }
+
+    int bits = info->bits_per_sample;
+    int ok_pcm   = info->format == WAV_FORMAT_PCM && (bits == 8 || bits == 16 || bits == 24 || bits == 32);
+    int ok_float = info->format == WAV_FORMAT_FLOAT && (bits == 32 || bits == 64);
+
+    if (!have_fmt || !have_data || !(ok_pcm || ok_float) || info->channels < 1 || info->sample_rate < 1)
+        return -1;
+
+    info->block_align = info->channels * bits / 8;
+    info->frames      = info->data_bytes / info->block_align;
+    info->data_bytes  = info->frames * info->block_align;
+    return 0;
+}
+
+// ffmpeg-style codec name of the samples.
+const char *wav_codec_name(const wav_info_t *info) {
+    if (info->format == WAV_FORMAT_FLOAT)
+        return info->bits_per_sample == 64 ? "pcm_f64le" : "pcm_f32le";
+
+    switch (info->bits_per_sample) {
+        case 8:  return "pcm_u8";
+        case 16: return "pcm_s16le";
+        case 24: return "pcm_s24le";
+        default: return "pcm_s32le";
+    }
+}